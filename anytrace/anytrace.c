@@ -8,17 +8,19 @@
 
 static void
 usage(const char *prog) {
-    printf("usage : %s -p <pid>\n", prog);
+    printf("usage : %s [-c <cache dir>] [-g <debug dir>] -p <pid>\n", prog);
 }
 
 int
 main(int argc, char **argv)
 {
     int pid = -1;
+    const char *cache_dir = NULL;
+    const char *debug_dir = NULL;
 
     while (1) {
         int c;
-        c = getopt(argc, argv, "p:");
+        c = getopt(argc, argv, "p:c:g:");
         if (c == -1) {
             break;
         }
@@ -28,6 +30,14 @@ main(int argc, char **argv)
             pid = atoi(optarg);
             break;
 
+        case 'c':
+            cache_dir = optarg;
+            break;
+
+        case 'g':
+            debug_dir = optarg;
+            break;
+
         default :
             usage(argv[0]);
             exit(1);
@@ -43,6 +53,10 @@ main(int argc, char **argv)
     struct ATR_process proc;
 
     ATR_init(&atr);
+    atr.cache_dir = cache_dir;
+    if (debug_dir) {
+        atr.debug_dir = debug_dir;
+    }
 
     int r = ATR_open_process(&proc, &atr, pid);
     if (r < 0) {
@@ -61,6 +75,9 @@ main(int argc, char **argv)
         struct ATR_stack_frame_entry *e = &frame.entries[di];
 
         printf("#%d ", di);
+        if (e->flags & ATR_FRAME_IS_INLINED) {
+            printf("[inlined] ");
+        }
         if (e->flags & ATR_FRAME_HAVE_PC) {
             if (e->flags & ATR_FRAME_HAVE_SYMBOL) {
                 printf("%s+0x%x(addr=%p) ",
@@ -76,6 +93,11 @@ main(int argc, char **argv)
             printf("(%s)",
                    e->obj_path);
         }
+        if (e->flags & ATR_FRAME_HAVE_LOCATION) {
+            printf(" at %s:%d",
+                   e->source_path,
+                   e->lineno);
+        }
 
         printf("\n");
     }
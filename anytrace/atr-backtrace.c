@@ -9,6 +9,8 @@
 #include "anytrace/atr-process.h"
 #include "anytrace/atr-file.h"
 #include "npr/symbol.h"
+#include "npr/varray.h"
+#include "npr/red-black-tree.h"
 
 #include "anytrace/atr-backtrace.h"
 
@@ -37,7 +39,6 @@ read2(unsigned char *p)
 #endif
 }
 
-#if 0
 static uint64_t
 read8(unsigned char *p)
 {
@@ -66,7 +67,6 @@ read8(unsigned char *p)
 #endif
 
 }
-#endif
 
 static signed int
 read_leb128(unsigned char *ptr,
@@ -114,16 +114,118 @@ read_uleb128(unsigned char *ptr,
     return ret;
 }
 
+/* read DW_EH_PE_* encoded pointer.
+ * section_vaddr is vaddr of base (used by DW_EH_PE_pcrel),
+ * data_vaddr is base of DW_EH_PE_datarel.
+ *
+ * return -1 if encoding is not supported
+ */
+static int
+read_encoded_ptr(uintptr_t *ret,
+                 unsigned char *base,
+                 unsigned int *cur,
+                 unsigned int enc,
+                 uintptr_t section_vaddr,
+                 uintptr_t data_vaddr)
+{
+    uintptr_t field_vaddr = section_vaddr + *cur;
+    unsigned char *p = base + *cur;
+    uintptr_t val;
+
+    if (enc == DW_EH_PE_omit) {
+        return -1;
+    }
+
+    switch (enc & 0x0f) {
+    case DW_EH_PE_absptr:
+        if (sizeof(uintptr_t) == 8) {
+            val = read8(p);
+            (*cur) += 8;
+        } else {
+            val = read4(p);
+            (*cur) += 4;
+        }
+        break;
+
+    case DW_EH_PE_udata2:
+        val = read2(p);
+        (*cur) += 2;
+        break;
+
+    case DW_EH_PE_sdata2:
+        val = (int16_t)read2(p);
+        (*cur) += 2;
+        break;
+
+    case DW_EH_PE_udata4:
+        val = read4(p);
+        (*cur) += 4;
+        break;
+
+    case DW_EH_PE_sdata4:
+        val = (int32_t)read4(p);
+        (*cur) += 4;
+        break;
+
+    case DW_EH_PE_udata8:
+    case DW_EH_PE_sdata8:
+        val = read8(p);
+        (*cur) += 8;
+        break;
+
+    case DW_EH_PE_uleb128:
+        val = (unsigned int)read_uleb128(base, cur);
+        break;
+
+    case DW_EH_PE_sleb128:
+        val = read_leb128(base, cur);
+        break;
+
+    default:
+        return -1;
+    }
+
+    switch (enc & 0x70) {
+    case DW_EH_PE_absptr:
+        break;
+
+    case DW_EH_PE_pcrel:
+        val += field_vaddr;
+        break;
+
+    case DW_EH_PE_datarel:
+        val += data_vaddr;
+        break;
+
+    default:
+        return -1;
+    }
+
+    *ret = val;
+    return 0;
+}
+
 
 struct cfa_reg {
     int defined;
     int cfa_offset;
 };
 
-struct cfa_exec_env {
-    struct cfa_exec_env *chain;
+/* x86-64 DWARF columns : 0-15 gpr, 16 return address, 17-32 xmm */
+#define CFA_NUM_COLUMN 33
+#define CFA_MAX_REMEMBER_STATE 8
+
+struct cfa_saved_state {
+    struct cfa_reg regs[CFA_NUM_COLUMN];
+
+    int column_width;
+    int cfa_offset;
+    int cfa_reg;
+};
 
-    struct cfa_reg *regs;
+/* no heap allocation. lives on stack of caller */
+struct cfa_exec_env {
+    struct cfa_reg regs[CFA_NUM_COLUMN];
 
     int data_align;
     int code_align;
@@ -132,107 +234,156 @@ struct cfa_exec_env {
     int cfa_offset;
     int cfa_reg;
     int return_address_column;
+
+    int num_remembered;         // DW_CFA_remember_state
+    struct cfa_saved_state remembered[CFA_MAX_REMEMBER_STATE];
 };
 
 static void
-dump_cfa_exec_env(struct cfa_exec_env *env)
+init_cfa_env(struct cfa_exec_env *env)
 {
-    printf("cfa_offset = %d\n", env->cfa_offset);
-    printf("cfa_reg = %d\n", env->cfa_reg);
-    printf("nreg = %d\n", env->column_width);
-    for (int ri=0; ri<env->column_width; ri++) {
-        printf("reg[%3d] = %8d\n", ri, env->regs[ri].cfa_offset);
-    }
+    env->column_width = 0;
+    env->cfa_offset = 0;
+    env->cfa_reg = 0;
+    env->num_remembered = 0;
 }
 
-static void
+/* return -1 if column is out of range */
+static int
 reserve_column_width(struct cfa_exec_env *env,
                      int column)
 {
+    if (column < 0 || column >= CFA_NUM_COLUMN) {
+        return -1;
+    }
+
     if (env->column_width < column+1) {
         int prev = env->column_width;
 
         env->column_width = column + 1;
-        env->regs = realloc(env->regs, env->column_width * sizeof(struct cfa_reg));
 
         for (int ri=prev; ri<column+1; ri++) {
             env->regs[ri].cfa_offset = 0;
             env->regs[ri].defined = 0;
         }
     }
+
+    return 0;
 }
 
-static void
-copy_cfa_env(struct cfa_exec_env *dst,
-             struct cfa_exec_env *src)
+static int
+remember_cfa_state(struct cfa_exec_env *env)
 {
-    reserve_column_width(dst, src->column_width);
+    if (env->num_remembered >= CFA_MAX_REMEMBER_STATE) {
+        return -1;
+    }
 
-    memcpy(dst->regs, src->regs,
-           src->column_width * sizeof(struct cfa_reg));
+    struct cfa_saved_state *st = &env->remembered[env->num_remembered++];
 
-    dst->data_align = src->data_align;
-    dst->code_align = src->code_align;
-    dst->cfa_offset = src->cfa_offset;
-    dst->cfa_reg = src->cfa_reg;
-    dst->return_address_column = src->return_address_column;
+    memcpy(st->regs, env->regs, env->column_width * sizeof(struct cfa_reg));
+    st->column_width = env->column_width;
+    st->cfa_offset = env->cfa_offset;
+    st->cfa_reg = env->cfa_reg;
+
+    return 0;
 }
 
-static struct cfa_exec_env *
-push_cfa_env(struct cfa_exec_env *env)
+static int
+restore_cfa_state(struct cfa_exec_env *env)
 {
-    struct cfa_exec_env *top = malloc(sizeof(struct cfa_exec_env));
+    if (env->num_remembered == 0) {
+        return -1;
+    }
 
-    top->regs = NULL;
-    top->column_width = 0;
-    copy_cfa_env(top, env);
+    struct cfa_saved_state *st = &env->remembered[--env->num_remembered];
 
-    top->chain = env;
+    memcpy(env->regs, st->regs, st->column_width * sizeof(struct cfa_reg));
+    env->column_width = st->column_width;
+    env->cfa_offset = st->cfa_offset;
+    env->cfa_reg = st->cfa_reg;
 
-    return top;
+    return 0;
 }
 
-static struct cfa_exec_env *
-pop_cfa_env(struct cfa_exec_env *env)
+static void
+snapshot_stack(struct ATR *atr,
+               struct ATR_task_sample *sample,
+               struct ATR_process *proc,
+               size_t snapshot_size)
 {
-    struct cfa_exec_env *next = env->chain;
+    uintptr_t sp = sample->regs[X8664_CFA_REG_RSP];
+    size_t length = snapshot_size;
+    struct ATR_mapping *map = ATR_find_mapping(proc, sp);
 
-    free(env->regs);
-    free(env);
+    if (map && map->end - sp < length) {
+        length = map->end - sp;
+    }
 
-    return next;
-}
+    sample->stack = malloc(length);
 
-static void
-free_cfa_env(struct cfa_exec_env *env)
-{
-    free(env->regs);
-    free(env);
+    int r = ATR_read_memory(atr, proc, sample->stack, sp, length);
+    if (r < 0) {
+        /* fall back to read on demand */
+        ATR_error_clear(atr, &atr->last_error);
+        free(sample->stack);
+        sample->stack = NULL;
+        return;
+    }
+
+    sample->stack_start = sp;
+    sample->stack_length = length;
 }
 
-static void
-cleanup_cfa_stack(struct cfa_exec_env *env,
-                  struct cfa_exec_env *last)
+/* read saved registers from snapshot, or from target */
+static int
+read_frame(struct ATR *atr,
+           struct ATR_backtracer *tr,
+           struct ATR_process *proc,
+           struct ATR_mem_read *reads,
+           int num_read)
 {
-    if (env == last) {
-        return;
-    }
+    if (tr->stack) {
+        int num_remote = 0;
+
+        for (int ri=0; ri<num_read; ri++) {
+            uintptr_t addr = reads[ri].addr;
+
+            if (addr >= tr->stack_start &&
+                addr + reads[ri].length <= tr->stack_start + tr->stack_length)
+            {
+                memcpy(reads[ri].dst,
+                       tr->stack + (addr - tr->stack_start),
+                       reads[ri].length);
+            } else {
+                reads[num_remote++] = reads[ri];
+            }
+        }
 
-    copy_cfa_env(last, env);
+        num_read = num_remote;
+    }
 
-    while (env != last) {
-        struct cfa_exec_env *n = env->chain;
-        free_cfa_env(env);
-        env = n;
+    if (num_read == 0) {
+        return 0;
     }
-}
 
+    return ATR_read_memory_gather(atr, proc, reads, num_read);
+}
 
 int
 ATR_backtrace_init(struct ATR *atr,
                    struct ATR_backtracer *tr,
                    struct ATR_process *proc,
                    int tid)
+{
+    return ATR_backtrace_init_snapshot(atr, tr, proc, tid, 0);
+}
+
+int
+ATR_capture_task(struct ATR *atr,
+                 struct ATR_task_sample *sample,
+                 struct ATR_process *proc,
+                 int tid,
+                 size_t snapshot_size)
 {
     struct user_regs_struct regs;
     errno = 0;
@@ -242,35 +393,64 @@ ATR_backtrace_init(struct ATR *atr,
         return -1;
     }
 
-    tr->cfa_regs[0] = regs.rax;
-    tr->cfa_regs[1] = regs.rdx;
-    tr->cfa_regs[2] = regs.rcx;
-    tr->cfa_regs[3] = regs.rbx;
-    tr->cfa_regs[4] = regs.rsi;
-    tr->cfa_regs[5] = regs.rdi;
-    tr->cfa_regs[6] = regs.rbp;
-    tr->cfa_regs[7] = regs.rsp;
-    tr->cfa_regs[8] = regs.r8;
-    tr->cfa_regs[9] = regs.r9;
-    tr->cfa_regs[10] = regs.r10;
-    tr->cfa_regs[11] = regs.r11;
-    tr->cfa_regs[12] = regs.r12;
-    tr->cfa_regs[13] = regs.r13;
-    tr->cfa_regs[14] = regs.r14;
-    tr->cfa_regs[15] = regs.r15;
-    tr->cfa_regs[16] = regs.rip;
-    tr->tid = tid;
+    sample->tid = tid;
+
+    sample->regs[0] = regs.rax;
+    sample->regs[1] = regs.rdx;
+    sample->regs[2] = regs.rcx;
+    sample->regs[3] = regs.rbx;
+    sample->regs[4] = regs.rsi;
+    sample->regs[5] = regs.rdi;
+    sample->regs[6] = regs.rbp;
+    sample->regs[7] = regs.rsp;
+    sample->regs[8] = regs.r8;
+    sample->regs[9] = regs.r9;
+    sample->regs[10] = regs.r10;
+    sample->regs[11] = regs.r11;
+    sample->regs[12] = regs.r12;
+    sample->regs[13] = regs.r13;
+    sample->regs[14] = regs.r14;
+    sample->regs[15] = regs.r15;
+    sample->regs[16] = regs.rip;
+    sample->regs[17] = 0;
+
+    sample->stack = NULL;
+    sample->stack_start = 0;
+    sample->stack_length = 0;
+
+    if (snapshot_size) {
+        snapshot_stack(atr, sample, proc, snapshot_size);
+    }
+
+    return 0;
+}
+
+int
+ATR_backtrace_init_sample(struct ATR *atr,
+                          struct ATR_backtracer *tr,
+                          struct ATR_process *proc,
+                          const struct ATR_task_sample *sample)
+{
+    memcpy(tr->cfa_regs, sample->regs, sizeof(tr->cfa_regs));
+    tr->tid = sample->tid;
+    tr->unwind_method = atr->unwind_method;
+
+    tr->stack = sample->stack;
+    tr->stack_start = sample->stack_start;
+    tr->stack_length = sample->stack_length;
+    tr->own_stack = 0;
 
     struct ATR_map_info mapi;
+    uintptr_t pc = sample->regs[X8664_CFA_REG_RIP];
 
-    int r = ATR_lookup_map_info(&mapi, atr, proc, regs.rip);
+    int r = ATR_lookup_map_info(&mapi, atr, proc, pc);
     if (r != 0) {
         return -1;
     }
     //printf("file=%s, pc = %llx\n", mapi.path->symstr, pc);
 
-    r = ATR_file_open(&tr->current_module, atr, mapi.path);
-    if (r != 0) {
+    tr->current_module = ATR_process_module_file(atr, proc, mapi.module);
+    if (tr->current_module == NULL) {
         return -1;
     }
 
@@ -280,11 +460,40 @@ ATR_backtrace_init(struct ATR *atr,
     return 0;
 }
 
+int
+ATR_backtrace_init_snapshot(struct ATR *atr,
+                            struct ATR_backtracer *tr,
+                            struct ATR_process *proc,
+                            int tid,
+                            size_t snapshot_size)
+{
+    struct ATR_task_sample sample;
+
+    int r = ATR_capture_task(atr, &sample, proc, tid, snapshot_size);
+    if (r < 0) {
+        return -1;
+    }
+
+    r = ATR_backtrace_init_sample(atr, tr, proc, &sample);
+    if (r < 0) {
+        /* caller doesn't fini tr if init failed */
+        free(sample.stack);
+        tr->stack = NULL;
+        return -1;
+    }
+
+    /* backtracer owns copy of stack */
+    tr->own_stack = 1;
+
+    return 0;
+}
+
 void
 ATR_backtrace_fini(struct ATR *atr, struct ATR_backtracer *tr)
 {
-    if (tr->state == ATR_BACKTRACER_OK) {
-        ATR_file_close(atr, &tr->current_module);
+    /* current_module is owned by ATR_process */
+    if (tr->own_stack) {
+        free(tr->stack);
     }
 }
 
@@ -296,30 +505,125 @@ set_cfa_offset(struct cfa_reg *reg, int offset)
     reg->cfa_offset = offset;
 }
 
+struct unwind_table_builder {
+    struct npr_varray rows;
+};
+
+static void
+push_unwind_row(struct unwind_table_builder *b,
+                struct ATR_unwind_row *row)
+{
+    struct npr_varray *rows = &b->rows;
+
+    /* later row wins */
+    while (rows->nelem > 0 &&
+           VA_LAST_PTR(struct ATR_unwind_row, rows)->pc_begin >= row->pc_begin)
+    {
+        rows->nelem--;
+    }
+
+    if (rows->nelem > 0) {
+        struct ATR_unwind_row *last = VA_LAST_PTR(struct ATR_unwind_row, rows);
+
+        if (last->type == row->type &&
+            last->cfa_reg == row->cfa_reg &&
+            last->cfa_offset == row->cfa_offset &&
+            last->ra_offset == row->ra_offset &&
+            last->rbp_offset == row->rbp_offset &&
+            last->flags == row->flags)
+        {
+            /* same rule */
+            return;
+        }
+    }
+
+    VA_PUSH(struct ATR_unwind_row, rows, *row);
+}
+
+static void
+push_unwind_row_type(struct unwind_table_builder *b,
+                     uintptr_t pc_begin,
+                     int type)
+{
+    struct ATR_unwind_row row;
+
+    memset(&row, 0, sizeof(row));
+    row.pc_begin = pc_begin;
+    row.type = type;
+
+    push_unwind_row(b, &row);
+}
+
+static int
+fit_int16(int v)
+{
+    return v >= INT16_MIN && v <= INT16_MAX;
+}
+
+static void
+emit_unwind_row(struct unwind_table_builder *b,
+                struct cfa_exec_env *env,
+                uintptr_t pc_begin)
+{
+    struct ATR_unwind_row row;
+    int ra = env->return_address_column;
+    int rbp = X8664_CFA_REG_RBP;
+
+    memset(&row, 0, sizeof(row));
+    row.pc_begin = pc_begin;
+    row.type = ATR_UNWIND_ROW_INTERP;
+
+    if ((env->cfa_reg != X8664_CFA_REG_RSP && env->cfa_reg != rbp) ||
+        ra >= env->column_width ||
+        ! env->regs[ra].defined ||
+        ! fit_int16(env->regs[ra].cfa_offset))
+    {
+        push_unwind_row(b, &row);
+        return;
+    }
+
+    row.cfa_reg = env->cfa_reg;
+    row.cfa_offset = env->cfa_offset;
+    row.ra_offset = env->regs[ra].cfa_offset;
+
+    if (rbp < env->column_width && env->regs[rbp].defined) {
+        if (! fit_int16(env->regs[rbp].cfa_offset)) {
+            push_unwind_row(b, &row);
+            return;
+        }
+
+        row.flags |= ATR_UNWIND_ROW_RBP_SAVED;
+        row.rbp_offset = env->regs[rbp].cfa_offset;
+    }
+
+    row.type = ATR_UNWIND_ROW_CFA;
+    push_unwind_row(b, &row);
+}
+
 /* return 1 if finished */
 static int
 exec_cfa(struct ATR *atr,
-         struct cfa_exec_env *env_start,
+         struct cfa_exec_env *env,
          unsigned char *base,
          unsigned int *cur,
          unsigned int end,
          uintptr_t cfa_pc,
-         uintptr_t real_pc)
+         uintptr_t real_pc,
+         struct unwind_table_builder *builder)
 {
-    struct cfa_exec_env *env = env_start;
     int ret = -1;
 
     while (*(cur) < end) {
         unsigned int opc = base[*cur];
 
-        //printf("%08x:opc = %x\n", *cur, opc);
-        //dump_cfa_exec_env(env);
-
         (*cur)++;
 
 #define ADVANCE_PC(A)                                                   \
-        cfa_pc += A;                                                    \
-        if (cfa_pc >= real_pc) {                                        \
+        if (builder) {                                                  \
+            emit_unwind_row(builder, env, cfa_pc);                      \
+        }                                                               \
+        cfa_pc += (A) * env->code_align;                                \
+        if (cfa_pc > real_pc) {                                         \
             ret = 0;                                                    \
             goto fini;                                                  \
         }
@@ -334,8 +638,9 @@ exec_cfa(struct ATR *atr,
         case DW_CFA_offset: {
             int reg = opc & 0x3f;
             int off = read_leb128(base, cur);
-            reserve_column_width(env, reg);
-            set_cfa_offset(&env->regs[reg], off * env->data_align);
+            if (reserve_column_width(env, reg) == 0) {
+                set_cfa_offset(&env->regs[reg], off * env->data_align);
+            }
 
             //printf("reg=%x off=%x\n", reg, off);
         }
@@ -398,23 +703,24 @@ exec_cfa(struct ATR *atr,
                 break;
 
             case DW_CFA_remember_state:
-                env = push_cfa_env(env);
+                if (remember_cfa_state(env) < 0) {
+                    ATR_set_dwarf_invalid_cfa(atr, &atr->last_error, opc);
+                    ret = -1;
+                    goto fini;
+                }
                 break;
 
             case DW_CFA_restore_state:
-                if (env == env_start) {
+                if (restore_cfa_state(env) < 0) {
                     ATR_set_dwarf_invalid_cfa(atr, &atr->last_error, opc);
                     ret = -1;
                     goto fini;
                 }
-
-                env = pop_cfa_env(env);
                 break;
 
 
             default:
                 ATR_set_dwarf_unimplemented_cfa_op(atr, &atr->last_error, opc);
-                printf("DW_?? (%x)\n", opc);
                 ret = -1;
                 goto fini;
             }
@@ -422,13 +728,757 @@ exec_cfa(struct ATR *atr,
         }
     }
 
+    if (builder) {
+        emit_unwind_row(builder, env, cfa_pc);
+    }
+
     ret = 0;
 
 fini:
-    cleanup_cfa_stack(env, env_start);
+    env->num_remembered = 0;
     return ret;
 }
 
+/* pc range of FDE (cur is offset in .eh_frame) */
+static void
+fde_pc_range(uintptr_t *begin,
+             uintptr_t *end,
+             struct ATR_file *fp,
+             uintptr_t cur)
+{
+    unsigned char *base = fp->eh_frame.data;
+    int32_t begin0 = read4(base + cur + 8);
+    uint32_t range = read4(base + cur + 12);
+
+    *begin = fp->eh_frame.vaddr + cur + 8 + begin0;
+    *end = *begin + range;
+}
+
+/* binary search sorted FDE table in .eh_frame_hdr
+ *
+ * return 0 if found,
+ *       -1 if pc is not covered by the table,
+ *       -2 if .eh_frame_hdr is not available
+ */
+static int
+find_fde_hdr(uintptr_t *fde_offset,
+             struct ATR_file *fp,
+             uintptr_t pc)
+{
+    struct ATR_section *hdr = &fp->eh_frame_hdr;
+
+    if (hdr->length < 4) {
+        return -2;
+    }
+
+    /* version        1
+     * eh_frame_ptr   enc 1
+     * fde_count      enc 1
+     * table          enc 1
+     * eh_frame_ptr
+     * fde_count
+     * table[fde_count] { initial_loc, fde_addr }
+     */
+    unsigned char *base = ATR_file_section_data(fp, hdr);
+    if (base == NULL) {
+        return -2;
+    }
+    unsigned int version = base[0];
+    unsigned int eh_frame_ptr_enc = base[1];
+    unsigned int fde_count_enc = base[2];
+    unsigned int table_enc = base[3];
+    unsigned int cur = 4;
+    uintptr_t eh_frame_ptr, fde_count;
+
+    if (version != 1) {
+        return -2;
+    }
+
+    if (read_encoded_ptr(&eh_frame_ptr, base, &cur, eh_frame_ptr_enc,
+                         hdr->vaddr, hdr->vaddr) < 0)
+    {
+        return -2;
+    }
+
+    if (read_encoded_ptr(&fde_count, base, &cur, fde_count_enc,
+                         hdr->vaddr, hdr->vaddr) < 0)
+    {
+        return -2;
+    }
+
+    unsigned int field_size;
+
+    switch (table_enc & 0x0f) {
+    case DW_EH_PE_udata4:
+    case DW_EH_PE_sdata4:
+        field_size = 4;
+        break;
+
+    case DW_EH_PE_udata8:
+    case DW_EH_PE_sdata8:
+        field_size = 8;
+        break;
+
+    default:
+        /* variable length entry, can't bsearch */
+        return -2;
+    }
+
+    unsigned int table = cur;
+    unsigned int entry_size = field_size * 2;
+
+    if (table + fde_count * entry_size > hdr->length) {
+        return -2;
+    }
+
+    /* find last entry that satisfies initial_loc <= pc */
+    uintptr_t lo = 0, hi = fde_count;
+
+    while (lo < hi) {
+        uintptr_t mid = lo + (hi-lo)/2;
+        unsigned int ent = table + mid * entry_size;
+        uintptr_t initial_loc;
+
+        read_encoded_ptr(&initial_loc, base, &ent, table_enc,
+                         hdr->vaddr, hdr->vaddr);
+
+        if (initial_loc <= pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0) {
+        return -1;
+    }
+
+    unsigned int ent = table + (lo-1) * entry_size + field_size;
+    uintptr_t fde_addr;
+    read_encoded_ptr(&fde_addr, base, &ent, table_enc,
+                     hdr->vaddr, hdr->vaddr);
+
+    if (fde_addr < fp->eh_frame.vaddr ||
+        fde_addr >= fp->eh_frame.vaddr + fp->eh_frame.length)
+    {
+        return -1;
+    }
+
+    *fde_offset = fde_addr - fp->eh_frame.vaddr;
+    return 0;
+}
+
+static int
+cmp_fde_index_entry(const void *a, const void *b)
+{
+    const struct ATR_fde_index_entry *ea = a;
+    const struct ATR_fde_index_entry *eb = b;
+
+    if (ea->pc_begin < eb->pc_begin) {
+        return -1;
+    }
+    if (ea->pc_begin > eb->pc_begin) {
+        return 1;
+    }
+    return 0;
+}
+
+/* walk .eh_frame once and build sorted (pc_begin, fde_offset) table */
+static void
+build_fde_index(struct ATR_file *fp)
+{
+    uintptr_t cur = 0;
+    size_t length = fp->eh_frame.length;
+    unsigned char *base = fp->eh_frame.data;
+
+    struct npr_varray index;
+    npr_varray_init(&index, 64, sizeof(struct ATR_fde_index_entry));
+
+    while (cur < length) {
+        uint32_t length = read4(base + cur);
+        if (length == 0) {
+            break;
+        }
+
+        uint32_t id = read4(base + cur + 4);
+
+        if (id != 0) {
+            /* FDE */
+            uintptr_t begin, end;
+            fde_pc_range(&begin, &end, fp, cur);
+
+            if (begin != end) {
+                struct ATR_fde_index_entry *e;
+                VA_NEWELEM_LASTPTR(struct ATR_fde_index_entry, &index, e);
+                e->pc_begin = begin;
+                e->fde_offset = cur;
+            }
+        }
+
+        cur += length + 4;
+    }
+
+    fp->num_fde_index = index.nelem;
+    fp->fde_index = npr_varray_malloc_close(&index);
+
+    qsort(fp->fde_index, fp->num_fde_index,
+          sizeof(struct ATR_fde_index_entry),
+          cmp_fde_index_entry);
+
+    fp->fde_index_built = 1;
+}
+
+/* return 0 if found, -1 if not found */
+static int
+find_fde_index(uintptr_t *fde_offset,
+               struct ATR_file *fp,
+               uintptr_t pc)
+{
+    if (! fp->fde_index_built) {
+        build_fde_index(fp);
+    }
+
+    /* find last entry that satisfies pc_begin <= pc */
+    size_t lo = 0, hi = fp->num_fde_index;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi-lo)/2;
+
+        if (fp->fde_index[mid].pc_begin <= pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0) {
+        return -1;
+    }
+
+    *fde_offset = fp->fde_index[lo-1].fde_offset;
+    return 0;
+}
+
+/* CIE with initial instructions executed. (ATR_file::cie_cache) */
+struct parsed_cie {
+    int have_aug;
+
+    int data_align;
+    int code_align;
+    int return_address_column;
+
+    struct cfa_saved_state initial;
+};
+
+/* return NULL if failed */
+static struct parsed_cie *
+parse_cie(struct ATR *atr,
+          struct ATR_file *fp,
+          uintptr_t cie)
+{
+    if (fp->cie_cache == NULL) {
+        fp->cie_cache = malloc(sizeof(struct npr_rbtree));
+        npr_rbtree_init(fp->cie_cache);
+    }
+
+    struct npr_rbtree_node *n = npr_rbtree_find(fp->cie_cache, cie);
+    if (n) {
+        return (struct parsed_cie*)n->v;
+    }
+
+    unsigned char *base = fp->eh_frame.data;
+    uint32_t cie_length = read4(base + cie);
+    struct cfa_exec_env env;
+
+    init_cfa_env(&env);
+
+    /* CIE */
+    /* length  4
+     * id      4
+     * version 1
+     */
+    unsigned int cie_cur = cie + 9;
+    unsigned int have_aug = 0;
+
+    while (1){ /* ?? */
+        unsigned int c = base[cie_cur++];
+        if (c == '\0') {
+            break;
+        }
+        if (c == 'z') {
+            have_aug = 1;
+        }
+    }
+
+    env.code_align = read_leb128(base, &cie_cur); /* code alignment factor */
+    env.data_align = read_leb128(base, &cie_cur); /* data lignment factor */
+
+    env.return_address_column = read_leb128(base, &cie_cur); /* return address register */
+
+    if (reserve_column_width(&env, env.return_address_column) < 0) {
+        ATR_set_dwarf_invalid_cfa(atr, &atr->last_error, 0);
+        return NULL;
+    }
+
+    if (have_aug) {
+        unsigned int length = read_leb128(base, &cie_cur);
+        cie_cur += length;
+    }
+
+    //printf("cie = %x, cur = %x\n", (int)cie_cur, (int)cie);
+    int r = exec_cfa(atr, &env, base, &cie_cur, cie+cie_length+4, 0, (uintptr_t)-1, NULL);
+    if (r < 0) {
+        return NULL;
+    }
+
+    struct parsed_cie *p = malloc(sizeof(*p));
+
+    p->have_aug = have_aug;
+    p->data_align = env.data_align;
+    p->code_align = env.code_align;
+    p->return_address_column = env.return_address_column;
+
+    memcpy(p->initial.regs, env.regs, env.column_width * sizeof(struct cfa_reg));
+    p->initial.column_width = env.column_width;
+    p->initial.cfa_offset = env.cfa_offset;
+    p->initial.cfa_reg = env.cfa_reg;
+
+    npr_rbtree_insert(fp->cie_cache, cie, (npr_rbtree_value_t)p);
+
+    return p;
+}
+
+/* start env from initial state of CIE of FDE.
+ * *fde_cur is set to the first instruction of FDE
+ *
+ * return -1 if failed
+ */
+static int
+exec_cie(struct ATR *atr,
+         struct cfa_exec_env *env,
+         struct ATR_file *fp,
+         uintptr_t fde,
+         unsigned int *fde_cur)
+{
+    unsigned char *base = fp->eh_frame.data;
+
+    /* CIE pointer is relative to its own field */
+    uintptr_t cie = fde + 4 - read4(base + fde + 4);
+
+    struct parsed_cie *p = parse_cie(atr, fp, cie);
+    if (p == NULL) {
+        return -1;
+    }
+
+    env->data_align = p->data_align;
+    env->code_align = p->code_align;
+    env->return_address_column = p->return_address_column;
+
+    memcpy(env->regs, p->initial.regs, p->initial.column_width * sizeof(struct cfa_reg));
+    env->column_width = p->initial.column_width;
+    env->cfa_offset = p->initial.cfa_offset;
+    env->cfa_reg = p->initial.cfa_reg;
+    env->num_remembered = 0;
+
+    /* FDE */
+    *fde_cur = fde + 16;
+
+    if (p->have_aug) {
+        unsigned int length = read_leb128(base, fde_cur);
+        *fde_cur += length;
+    }
+
+    return 0;
+}
+
+void
+ATR_file_compile_unwind_table(struct ATR *atr, struct ATR_file *fp)
+{
+    struct unwind_table_builder b;
+    unsigned char *base = ATR_file_section_data(fp, &fp->eh_frame);
+
+    fp->unwind_table_built = 1;
+
+    if (base == NULL) {
+        return;
+    }
+
+    /* visit FDEs in pc order */
+    if (! fp->fde_index_built) {
+        build_fde_index(fp);
+    }
+
+    npr_varray_init(&b.rows, 64, sizeof(struct ATR_unwind_row));
+
+    struct cfa_exec_env exec_env;
+
+    for (size_t fi=0; fi<fp->num_fde_index; fi++) {
+        uintptr_t fde = fp->fde_index[fi].fde_offset;
+        uintptr_t begin, end;
+        fde_pc_range(&begin, &end, fp, fde);
+
+        uint32_t fde_length = read4(base + fde);
+        unsigned int fde_cur;
+
+        init_cfa_env(&exec_env);
+
+        int r = exec_cie(atr, &exec_env, fp, fde, &fde_cur);
+        if (r == 0) {
+            r = exec_cfa(atr, &exec_env, base, &fde_cur, fde+fde_length+4,
+                         begin, (uintptr_t)-1, &b);
+        }
+
+        if (r < 0) {
+            /* leave this FDE to interpreter */
+            ATR_error_clear(atr, &atr->last_error);
+            push_unwind_row_type(&b, begin, ATR_UNWIND_ROW_INTERP);
+        }
+
+        push_unwind_row_type(&b, end, ATR_UNWIND_ROW_END);
+    }
+
+    fp->num_unwind_row = b.rows.nelem;
+    fp->unwind_table = npr_varray_malloc_close(&b.rows);
+
+    ATR_file_store_cache(atr, fp);
+}
+
+static struct ATR_unwind_row *
+lookup_unwind_row(struct ATR_file *fp,
+                  uintptr_t pc)
+{
+    /* find last row that satisfies pc_begin <= pc */
+    size_t lo = 0, hi = fp->num_unwind_row;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi-lo)/2;
+
+        if (fp->unwind_table[mid].pc_begin <= pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0) {
+        return NULL;
+    }
+
+    return &fp->unwind_table[lo-1];
+}
+
+/* resolved unwind rule of one pc. (ATR_file::unwind_memo) */
+struct ATR_unwind_memo {
+    uintptr_t pc_offset;        // key. offset in module
+    uint64_t last_use;          // 0 if empty
+
+    int cfa_offset;
+    uint8_t cfa_reg;
+    uint8_t return_address_column;
+
+    uint32_t saved_mask;        // (1<<ci) : column ci is saved at CFA+saved_offset[ci]
+    int saved_offset[ATR_TRACER_NUM_REG];
+};
+
+#define UNWIND_MEMO_WAY 4
+
+static struct ATR_unwind_memo *
+unwind_memo_set(struct ATR_file *fp,
+                uintptr_t pc_offset)
+{
+    size_t h = pc_offset ^ (pc_offset >> 10);
+    return &fp->unwind_memo[(h & (fp->unwind_memo_num_set-1)) * UNWIND_MEMO_WAY];
+}
+
+/* return NULL if not found */
+static struct ATR_unwind_memo *
+lookup_unwind_memo(struct ATR *atr,
+                   struct ATR_file *fp,
+                   uintptr_t pc_offset)
+{
+    if (atr->unwind_memo_size == 0) {
+        return NULL;
+    }
+
+    if (fp->unwind_memo == NULL) {
+        size_t num_set = 1;
+        while (num_set * UNWIND_MEMO_WAY < atr->unwind_memo_size) {
+            num_set *= 2;
+        }
+
+        fp->unwind_memo = calloc(num_set * UNWIND_MEMO_WAY, sizeof(struct ATR_unwind_memo));
+        fp->unwind_memo_num_set = num_set;
+    }
+
+    struct ATR_unwind_memo *set = unwind_memo_set(fp, pc_offset);
+
+    for (int wi=0; wi<UNWIND_MEMO_WAY; wi++) {
+        if (set[wi].last_use && set[wi].pc_offset == pc_offset) {
+            set[wi].last_use = ++fp->unwind_memo_clock;
+            atr->unwind_memo_hit++;
+            return &set[wi];
+        }
+    }
+
+    atr->unwind_memo_miss++;
+    return NULL;
+}
+
+static void
+insert_unwind_memo(struct ATR *atr,
+                   struct ATR_file *fp,
+                   uintptr_t pc_offset,
+                   const struct ATR_unwind_memo *rule)
+{
+    if (fp->unwind_memo == NULL) {
+        return;
+    }
+
+    /* replace least recently used entry */
+    struct ATR_unwind_memo *set = unwind_memo_set(fp, pc_offset);
+    struct ATR_unwind_memo *victim = &set[0];
+
+    for (int wi=1; wi<UNWIND_MEMO_WAY; wi++) {
+        if (set[wi].last_use < victim->last_use) {
+            victim = &set[wi];
+        }
+    }
+
+    *victim = *rule;
+    victim->pc_offset = pc_offset;
+    victim->last_use = ++fp->unwind_memo_clock;
+}
+
+static void
+make_unwind_rule(struct ATR_unwind_memo *rule,
+                 const struct cfa_exec_env *env)
+{
+    int nc = env->column_width;
+
+    if (nc > ATR_TRACER_NUM_REG) {
+        nc = ATR_TRACER_NUM_REG;
+    }
+
+    rule->cfa_offset = env->cfa_offset;
+    rule->cfa_reg = env->cfa_reg;
+    rule->return_address_column = env->return_address_column;
+    rule->saved_mask = 0;
+
+    for (int ci=0; ci<nc; ci++) {
+        if (env->regs[ci].defined) {
+            rule->saved_mask |= (1U<<ci);
+            rule->saved_offset[ci] = env->regs[ci].cfa_offset;
+        }
+    }
+}
+
+static void step_to_caller(struct ATR *atr,
+                           struct ATR_backtracer *tr,
+                           struct ATR_process *proc,
+                           uintptr_t return_addr);
+
+/* restore registers of caller by rule.
+ * return -1 if failed */
+static int
+apply_unwind_rule(struct ATR *atr,
+                  struct ATR_backtracer *tr,
+                  struct ATR_process *proc,
+                  const struct ATR_unwind_memo *rule)
+{
+    uintptr_t cfa_val = tr->cfa_regs[rule->cfa_reg];
+    uintptr_t cfa_top = cfa_val + rule->cfa_offset;
+
+    struct ATR_mem_read reads[ATR_TRACER_NUM_REG];
+    int num_read = 0;
+
+    /* read all saved registers at once.
+     * values are written to cfa_regs after all reads succeed */
+    uint64_t saved[ATR_TRACER_NUM_REG];
+
+    for (int ci=0; ci<ATR_TRACER_NUM_REG; ci++) {
+        if (rule->saved_mask & (1U<<ci)) {
+            reads[num_read].addr = cfa_top + rule->saved_offset[ci];
+            reads[num_read].length = sizeof(uint64_t);
+            reads[num_read].dst = &saved[ci];
+            num_read++;
+        }
+    }
+
+    if (read_frame(atr, tr, proc, reads, num_read) < 0) {
+        return -1;
+    }
+
+    for (int ci=0; ci<ATR_TRACER_NUM_REG; ci++) {
+        if (rule->saved_mask & (1U<<ci)) {
+            tr->cfa_regs[ci] = saved[ci];
+        }
+    }
+
+    uintptr_t return_addr = tr->cfa_regs[rule->return_address_column];
+
+    //printf("return_addr=%p, ret_addr_pos=%p, cfa_top=%p\n",
+    //       (int*)return_addr,
+    //       (int*)tr->cfa_regs[X8664_CFA_REG_RSP],
+    //       (int*)cfa_top);
+
+    tr->cfa_regs[X8664_CFA_REG_RSP] = cfa_top;
+
+    step_to_caller(atr, tr, proc, return_addr);
+
+    return 0;
+}
+
+/* move backtracer to module of return_addr */
+static void
+step_to_caller(struct ATR *atr,
+               struct ATR_backtracer *tr,
+               struct ATR_process *proc,
+               uintptr_t return_addr)
+{
+    struct ATR_map_info mapi;
+    int r = ATR_lookup_map_info(&mapi, atr, proc, return_addr);
+    if (r == 0) {
+        tr->current_module = ATR_process_module_file(atr, proc, mapi.module);
+        tr->pc_offset_in_module = mapi.offset;
+
+        if (tr->current_module == NULL) {
+            r = -1;
+        }
+    }
+
+    if (r != 0) {
+        tr->state = ATR_BACKTRACER_FRAME_BOTTOM;
+    }
+}
+
+/* pc is at an instruction where rbp doesn't point to frame of this function yet
+ * (or anymore) */
+static int
+in_prologue_or_epilogue(struct ATR_file *fp,
+                        uintptr_t pc_offset)
+{
+    struct ATR_section *text = &fp->text;
+
+    if (pc_offset < text->start || pc_offset + 4 > text->start + text->length) {
+        return 1;
+    }
+
+    unsigned char *text_data = ATR_file_section_data(fp, text);
+    if (text_data == NULL) {
+        return 1;
+    }
+
+    unsigned char *code = text_data + (pc_offset - text->start);
+
+    if (code[0] == 0xf3 && code[1] == 0x0f && code[2] == 0x1e && code[3] == 0xfa) {
+        /* endbr64 */
+        return 1;
+    }
+
+    if (code[0] == 0x55) {
+        /* push %rbp */
+        return 1;
+    }
+
+    if (code[0] == 0x48 && code[1] == 0x89 && code[2] == 0xe5) {
+        /* mov %rsp, %rbp */
+        return 1;
+    }
+
+    if (code[0] == 0xc3) {
+        /* ret (after pop %rbp or leave) */
+        return 1;
+    }
+
+    if (pc_offset > text->start && (code[-1] == 0x5d || code[-1] == 0xc9)) {
+        /* after pop %rbp or leave, before ret or tail call jmp.
+         * may be last byte of other instruction. then CFI is used
+         * without need */
+        return 1;
+    }
+
+    return 0;
+}
+
+#define FRAME_POINTER_MAX_FRAME_SIZE (16*1024*1024)
+
+/* walk one step of rbp chain.
+ * return -1 if chain looks broken (caller should use CFI) */
+static int
+unwind_frame_pointer(struct ATR *atr,
+                     struct ATR_backtracer *tr,
+                     struct ATR_process *proc)
+{
+    uintptr_t rbp = tr->cfa_regs[X8664_CFA_REG_RBP];
+    uintptr_t rsp = tr->cfa_regs[X8664_CFA_REG_RSP];
+
+    if (in_prologue_or_epilogue(tr->current_module, tr->pc_offset_in_module)) {
+        return -1;
+    }
+
+    if (rbp == 0 ||
+        (rbp & 7) != 0 ||
+        rbp < rsp ||
+        rbp - rsp > FRAME_POINTER_MAX_FRAME_SIZE)
+    {
+        return -1;
+    }
+
+    /* 0(%rbp) : saved rbp
+     * 8(%rbp) : return address */
+    uint64_t saved_rbp, return_addr;
+    struct ATR_mem_read reads[2];
+
+    reads[0].addr = rbp;
+    reads[0].length = sizeof(saved_rbp);
+    reads[0].dst = &saved_rbp;
+
+    reads[1].addr = rbp + 8;
+    reads[1].length = sizeof(return_addr);
+    reads[1].dst = &return_addr;
+
+    if (read_frame(atr, tr, proc, reads, 2) < 0) {
+        ATR_error_clear(atr, &atr->last_error);
+        return -1;
+    }
+
+    if (saved_rbp != 0 && saved_rbp <= rbp) {
+        /* stack grows down. caller's frame must be above */
+        return -1;
+    }
+
+    if (ATR_find_mapping(proc, return_addr) == NULL) {
+        return -1;
+    }
+
+    tr->cfa_regs[X8664_CFA_REG_RBP] = saved_rbp;
+    tr->cfa_regs[X8664_CFA_REG_RSP] = rbp + 16;
+    tr->cfa_regs[X8664_CFA_REG_RIP] = return_addr;
+
+    step_to_caller(atr, tr, proc, return_addr);
+
+    return 0;
+}
+
+/* ATR_UNWIND_FRAME_POINTER of ATR_backtracer.
+ * rbp of frameless function (e.g. syscall wrapper of libc) still points
+ * to frame of its caller, so rbp chain is followed only where CFI agrees
+ * that CFA is rbp+16 (saved rbp at 0(%rbp), return address at 8(%rbp)).
+ * return -1 if rule is not rbp based, or chain looks broken */
+static int
+unwind_frame_pointer_by_cfi(struct ATR *atr,
+                            struct ATR_backtracer *tr,
+                            struct ATR_process *proc,
+                            int cfa_reg,
+                            int cfa_offset)
+{
+    if (cfa_reg != X8664_CFA_REG_RBP || cfa_offset != 16) {
+        return -1;
+    }
+
+    return unwind_frame_pointer(atr, tr, proc);
+}
+
 int
 ATR_backtrace_up(struct ATR *atr,
                  struct ATR_backtracer *tr,
@@ -445,182 +1495,180 @@ ATR_backtrace_up(struct ATR *atr,
      * 3. extract from 16(%rbp)?
      */
 
-    struct cfa_exec_env exec_env, *fde_env = NULL;
+    struct cfa_exec_env exec_env;
     uintptr_t pc = tr->cfa_regs[X8664_CFA_REG_RIP];
-    uintptr_t pc_offset = pc_offset = tr->pc_offset_in_module;
+    uintptr_t pc_offset = tr->pc_offset_in_module;
+
+    init_cfa_env(&exec_env);
+
+    struct ATR_file *fp = tr->current_module;
 
-    exec_env.chain = NULL;
-    exec_env.regs = NULL;
-    exec_env.column_width = 0;
+    /* module is known to keep frame pointer (ATR_set_module_unwind_method).
+     * rbp chain is trusted without CFI */
+    if (fp->unwind_method == ATR_UNWIND_FRAME_POINTER) {
+        if (unwind_frame_pointer(atr, tr, proc) == 0) {
+            return 0;
+        }
+
+        /* fall back to CFI */
+    }
 
-    struct ATR_file *fp = &tr->current_module;
+    int use_fp = (fp->unwind_method == ATR_UNWIND_DEFAULT &&
+                  tr->unwind_method == ATR_UNWIND_FRAME_POINTER);
 
-    if (fp->eh_frame.length == 0) {
-        ATR_file_close(atr, &tr->current_module);
+    /* .eh_frame is mapped here, before any other access to it */
+    unsigned char *base = ATR_file_section_data(fp, &fp->eh_frame);
+    if (base == NULL) {
         ATR_set_frame_info_not_found(atr, &atr->last_error, fp->path, pc);
+        tr->state = ATR_BACKTRACER_HAVE_ERROR;
         return -1;
     }
 
     int ret = -1;
 
-    uintptr_t cur = 0;
-    size_t length = fp->eh_frame.length;
-    unsigned char *base = fp->mapped_addr + fp->eh_frame.start;
-
-    unsigned int have_aug = 0;
+    /* FDE ranges are described in vaddr of module */
+    uintptr_t pc_vaddr = pc_offset - fp->text.start + fp->text.vaddr;
+    uintptr_t fde;
+    int r;
 
-    while (cur < length) {
-        /* CIE */
-        uint32_t length = read4(base + cur);
-        if (length == 0) {
-            break;
+    /* table mapped from persistent cache is used without the flag */
+    if ((atr->flags & ATR_COMPILE_UNWIND_TABLE) || fp->unwind_table_built) {
+        if (! fp->unwind_table_built) {
+            ATR_file_compile_unwind_table(atr, fp);
         }
 
-        uint32_t id = read4(base + cur + 4);
+        struct ATR_unwind_row *row = lookup_unwind_row(fp, pc_vaddr);
 
-        if (id == (0ULL)) {
-            /* CIE */
-            /* length  4
-             * id      4
-             * version 1
-             */
-            unsigned int cie_cur = cur + 9;
-            have_aug = 0;
-
-            while (1){ /* ?? */
-                unsigned int c = base[cie_cur++];
-                if (c == '\0') {
-                    break;
-                }
-                if (c == 'z') {
-                    have_aug = 1;
-                }
-            }
+        if (row == NULL || row->type == ATR_UNWIND_ROW_END) {
+            goto not_found;
+        }
 
-            exec_env.code_align = read_leb128(base, &cie_cur); /* code alignment factor */
-            exec_env.data_align = read_leb128(base, &cie_cur); /* data lignment factor */
+        if (row->type == ATR_UNWIND_ROW_CFA) {
+            if (use_fp &&
+                unwind_frame_pointer_by_cfi(atr, tr, proc, row->cfa_reg, row->cfa_offset) == 0)
+            {
+                ret = 0;
+                goto fini;
+            }
 
-            exec_env.return_address_column = read_leb128(base, &cie_cur); /* return address register */
+            uintptr_t cfa_top = tr->cfa_regs[row->cfa_reg] + row->cfa_offset;
+            uint64_t return_addr, rbp;
+            struct ATR_mem_read reads[2];
+            int num_read = 1;
 
-            reserve_column_width(&exec_env, exec_env.return_address_column);
+            reads[0].addr = cfa_top + row->ra_offset;
+            reads[0].length = sizeof(return_addr);
+            reads[0].dst = &return_addr;
 
-            if (have_aug) {
-                unsigned int length = read_leb128(base, &cie_cur);
-                cie_cur += length;
+            if (row->flags & ATR_UNWIND_ROW_RBP_SAVED) {
+                reads[1].addr = cfa_top + row->rbp_offset;
+                reads[1].length = sizeof(rbp);
+                reads[1].dst = &rbp;
+                num_read = 2;
             }
 
-            //printf("cie = %x, cur = %x, pc = %x\n", (int)cie_cur, (int)cur, (int)pc_offset);
-            int r = exec_cfa(atr, &exec_env, base, &cie_cur, cur+length+4, 0, pc_offset);
-            if (r < 0) {
+            if (read_frame(atr, tr, proc, reads, num_read) < 0) {
                 goto fini;
             }
-        } else {
-            uint32_t begin0 = read4(base + cur + 8);
-            uint32_t range = read4(base + cur + 12);
 
-            uint32_t begin = (uint32_t)(fp->eh_frame.start + cur + 8 + begin0);
-            uint32_t end = begin + range;
-            unsigned int fde_cur = cur + 16;
+            if (num_read == 2) {
+                tr->cfa_regs[X8664_CFA_REG_RBP] = rbp;
+            }
 
-            if (pc_offset>=begin && pc_offset < end) {
-                if (have_aug) {
-                    unsigned int length = read_leb128(base, &fde_cur);
-                    fde_cur += length;
-                }
+            tr->cfa_regs[X8664_CFA_REG_RIP] = return_addr;
+            tr->cfa_regs[X8664_CFA_REG_RSP] = cfa_top;
 
-                fde_env = push_cfa_env(&exec_env);
-                //printf("fde = %x, cur = %x, pc = %x\n", (int)fde_cur, (int)cur, (int)pc_offset);
+            step_to_caller(atr, tr, proc, return_addr);
 
-                int r = exec_cfa(atr, fde_env, base, &fde_cur, cur+length+4, begin, pc_offset);
-                if (r == -1) {
-                    goto fini;
-                }
+            ret = 0;
+            goto fini;
+        }
 
-                if (r == -1) {
-                    ATR_set_libc_path_error(atr,
-                                            &atr->last_error,
-                                            errno, "ptrace");
-                    goto fini;
-                }
+        /* ATR_UNWIND_ROW_INTERP */
+    }
 
-                //printf("offset = %d, %d, cfa_reg = %d\n",
-                //       (int)fde_env->cfa_offset,
-                //       (int)fde_env->regs[fde_env->return_address_column].cfa_offset,
-                //       (int)fde_env->cfa_reg);
-
-                uintptr_t cfa_val = tr->cfa_regs[fde_env->cfa_reg];
-                uintptr_t cfa_top = cfa_val + fde_env->cfa_offset;
-
-                int nc = exec_env.column_width;
-
-                for (int ci=0; ci<nc; ci++) {
-                    if (fde_env->regs[ci].defined) {
-                        uintptr_t value_pos = cfa_top + fde_env->regs[ci].cfa_offset;
-                        uintptr_t reg_value;
-                        errno = 0;
-                        reg_value = ptrace(PTRACE_PEEKDATA, tr->tid,
-                                           (void*)value_pos, 0);
-
-                        if (errno != 0) {
-                            //printf("ci = %d %llx %llx\n", ci, (long long)fde_env->regs[ci].cfa_offset, (long long)cfa_top);
-                            ATR_set_read_frame_failed(atr, &atr->last_error,
-                                                      value_pos, errno);
-                            goto fini;
-                        }
-
-                        if (ci < ATR_TRACER_NUM_REG) {
-                            tr->cfa_regs[ci] = reg_value;
-                        }
-                    }
-                }
+    /* same pc has been unwound before */
+    struct ATR_unwind_memo *memo = lookup_unwind_memo(atr, fp, pc_offset);
+    if (memo) {
+        if (use_fp &&
+            unwind_frame_pointer_by_cfi(atr, tr, proc, memo->cfa_reg, memo->cfa_offset) == 0)
+        {
+            ret = 0;
+            goto fini;
+        }
 
-                uintptr_t return_addr = tr->cfa_regs[fde_env->return_address_column];
+        ret = apply_unwind_rule(atr, tr, proc, memo);
+        goto fini;
+    }
 
-                dump_cfa_exec_env(fde_env);
-                //printf("return_addr=%p, ret_addr_pos=%p, cfa_top=%p\n",
-                //       (int*)return_addr,
-                //       (int*)tr->cfa_regs[X8664_CFA_REG_RSP],
-                //       (int*)cfa_top);
+    r = find_fde_hdr(&fde, fp, pc_vaddr);
+    if (r == -2) {
+        r = find_fde_index(&fde, fp, pc_vaddr);
+    }
 
-                tr->cfa_regs[X8664_CFA_REG_RSP] = cfa_top;
+    if (r < 0) {
+        goto not_found;
+    }
 
-                ATR_file_close(atr, &tr->current_module);
-                struct ATR_map_info mapi;
-                r = ATR_lookup_map_info(&mapi, atr, proc, return_addr);
-                if (r == 0) {
-                    r = ATR_file_open(&tr->current_module, atr, mapi.path);
-                    tr->pc_offset_in_module = mapi.offset;
-                }
+    uintptr_t begin, end;
+    fde_pc_range(&begin, &end, fp, fde);
 
-                if (r != 0) {
-                    tr->state = ATR_BACKTRACER_FRAME_BOTTOM;
-                }
-                printf("file=%s, pc = %llx\n", mapi.path->symstr, (long long)pc);
+    if (pc_vaddr < begin || pc_vaddr >= end) {
+        goto not_found;
+    }
 
-                ret = 0;
-                goto fini;
-            } else {
-                //printf("FDE[%x,%x] != %x\n", (int)begin, (int)end, (int)pc_offset);
-            }
-            /* FDE */
-        }
+    uint32_t fde_length = read4(base + fde);
+    unsigned int fde_cur;
 
-        cur += length + 4;
+    r = exec_cie(atr, &exec_env, fp, fde, &fde_cur);
+    if (r < 0) {
+        goto fini;
     }
 
-    ATR_set_frame_info_not_found(atr, &atr->last_error, fp->path, pc);
+    //printf("fde = %x, cur = %x, pc = %x\n", (int)fde_cur, (int)fde, (int)pc_vaddr);
 
-fini:
+    r = exec_cfa(atr, &exec_env, base, &fde_cur, fde+fde_length+4, begin, pc_vaddr, NULL);
+    if (r == -1) {
+        goto fini;
+    }
 
-    if (fde_env) {
-        free_cfa_env(fde_env);
-        fde_env = NULL;
+    //printf("offset = %d, %d, cfa_reg = %d\n",
+    //       (int)exec_env.cfa_offset,
+    //       (int)exec_env.regs[exec_env.return_address_column].cfa_offset,
+    //       (int)exec_env.cfa_reg);
+
+    if (exec_env.cfa_reg < 0 || exec_env.cfa_reg >= ATR_TRACER_NUM_REG) {
+        ATR_set_dwarf_unknown_cfa_reg(atr, &atr->last_error,
+                                      exec_env.cfa_reg, fp->path, pc);
+        goto fini;
+    }
+
+    if (exec_env.return_address_column >= ATR_TRACER_NUM_REG) {
+        ATR_set_dwarf_invalid_cfa(atr, &atr->last_error, 0);
+        goto fini;
     }
 
-    free(exec_env.regs);
+    struct ATR_unwind_memo rule;
+    make_unwind_rule(&rule, &exec_env);
+
+    insert_unwind_memo(atr, fp, pc_offset, &rule);
+
+    if (use_fp &&
+        unwind_frame_pointer_by_cfi(atr, tr, proc, rule.cfa_reg, rule.cfa_offset) == 0)
+    {
+        ret = 0;
+        goto fini;
+    }
+
+    ret = apply_unwind_rule(atr, tr, proc, &rule);
+    goto fini;
+
+not_found:
+    ATR_set_frame_info_not_found(atr, &atr->last_error, fp->path, pc);
+
+fini:
 
     if (ret == -1) {
-        ATR_file_close(atr, &tr->current_module);
         tr->state = ATR_BACKTRACER_HAVE_ERROR;
     }
 
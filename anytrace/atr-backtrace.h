@@ -2,16 +2,18 @@
 #define ATR_BACKTRACE_H
 
 #include <stdint.h>
+#include "anytrace/atr.h"
 #include "anytrace/atr-file.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#define ATR_TRACER_NUM_REG 18
+#define ATR_TRACER_NUM_REG ATR_SAMPLE_NUM_REG
 
 #define X8664_CFA_REG_RIP 16
 #define X8664_CFA_REG_RSP 7
+#define X8664_CFA_REG_RBP 6
 
 enum ATR_backtracer_state {
     ATR_BACKTRACER_OK,
@@ -24,9 +26,20 @@ struct ATR_backtracer {
     enum ATR_backtracer_state state;
     int tid;
 
-    struct ATR_file current_module;
+    /* may be changed after ATR_backtrace_init.
+     * ATR_file::unwind_method has priority if it is specified */
+    enum ATR_unwind_method unwind_method;
+
+    struct ATR_file *current_module; // borrowed from ATR_process
     uintptr_t pc_offset_in_module;
     uint64_t cfa_regs[ATR_TRACER_NUM_REG];      // stored in dwarf order
+
+    /* copy of [stack_start, stack_start+stack_length) of target.
+     * NULL if stack is read on demand */
+    unsigned char *stack;
+    uintptr_t stack_start;
+    size_t stack_length;
+    int own_stack;              // 0 if stack is borrowed from ATR_task_sample
 };
 
 struct ATR_process;
@@ -38,6 +51,32 @@ int ATR_backtrace_init(struct ATR *atr,
                        struct ATR_process *proc,
                        int tid);
 
+/* copy up to snapshot_size bytes of stack from rsp in one read.
+ * after this returns, ATR_backtrace_up reads saved registers from
+ * the copy, so target thread can be resumed.
+ * (snapshot_size == 0 is same as ATR_backtrace_init)
+ * if this fails, nothing is left to ATR_backtrace_fini */
+int ATR_backtrace_init_snapshot(struct ATR *atr,
+                                struct ATR_backtracer *tr,
+                                struct ATR_process *proc,
+                                int tid,
+                                size_t snapshot_size);
+
+/* read registers of stopped task, and copy up to snapshot_size bytes of stack.
+ * return -1 if failed */
+int ATR_capture_task(struct ATR *atr,
+                     struct ATR_task_sample *sample,
+                     struct ATR_process *proc,
+                     int tid,
+                     size_t snapshot_size);
+
+/* start from captured task. sample->stack is borrowed, and
+ * should be alive until ATR_backtrace_fini */
+int ATR_backtrace_init_sample(struct ATR *atr,
+                              struct ATR_backtracer *tr,
+                              struct ATR_process *proc,
+                              const struct ATR_task_sample *sample);
+
 /* return -1 if failed */
 int ATR_backtrace_up(struct ATR *atr,
                      struct ATR_backtracer *tr,
@@ -45,6 +84,11 @@ int ATR_backtrace_up(struct ATR *atr,
 
 void ATR_backtrace_fini(struct ATR *atr, struct ATR_backtracer *tr);
 
+/* compile CFI of module into fp->unwind_table.
+ * ATR_backtrace_up calls this at first use of module if
+ * ATR_COMPILE_UNWIND_TABLE is set. */
+void ATR_file_compile_unwind_table(struct ATR *atr, struct ATR_file *fp);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,277 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "anytrace/atr.h"
+#include "anytrace/atr-file.h"
+#include "anytrace/atr-backtrace.h"
+#include "anytrace/atr-cache.h"
+#include "npr/symbol.h"
+
+/* sym_index of stripped module depends on whether its separate debug
+ * file is installed. cache built from other one is rebuilt */
+
+#define ALIGN8(v) (((v)+7) & ~(uint64_t)7)
+
+/* return malloc-ed path of cache file, NULL if cache is not available */
+static char *
+cache_path(struct ATR *atr,
+           struct ATR_file *fp)
+{
+    if (atr->cache_dir == NULL || fp->build_id == NULL) {
+        return NULL;
+    }
+
+    size_t len = strlen(atr->cache_dir) + 1 + strlen(fp->build_id->symstr) + sizeof(".atrc");
+    char *path = malloc(len);
+    snprintf(path, len, "%s/%s.atrc", atr->cache_dir, fp->build_id->symstr);
+
+    return path;
+}
+
+static uint32_t
+symtab_flags(struct ATR_file *fp)
+{
+    return (ATR_file_symbol_file(fp) != fp) ? ATR_CACHE_DEBUG_FILE_SYMTAB : 0;
+}
+
+/* return 1 if array of count * size bytes at offset is in file of length.
+ * written not to overflow with broken header */
+static int
+array_in_file(uint64_t offset, uint64_t count, uint64_t size, size_t length)
+{
+    if (offset > length || (offset & 7) != 0) {
+        return 0;
+    }
+
+    return count <= (length - offset) / size;
+}
+
+/* check values that are used as index or offset. cache file may be
+ * truncated or broken by another process, and it is mapped as is */
+static int
+cache_entries_valid(struct ATR_cache_header *h, unsigned char *addr)
+{
+    struct ATR_sym_index_entry *sym_index = (struct ATR_sym_index_entry*)(addr + h->sym_index_offset);
+    for (uint64_t si=0; si<h->num_sym_index; si++) {
+        if (sym_index[si].name >= h->names_length) {
+            return 0;
+        }
+    }
+
+    struct ATR_unwind_row *rows = (struct ATR_unwind_row*)(addr + h->unwind_table_offset);
+    for (uint64_t ri=0; ri<h->num_unwind_row; ri++) {
+        switch (rows[ri].type) {
+        case ATR_UNWIND_ROW_CFA:
+            if (rows[ri].cfa_reg != X8664_CFA_REG_RSP &&
+                rows[ri].cfa_reg != X8664_CFA_REG_RBP)
+            {
+                return 0;
+            }
+            break;
+
+        case ATR_UNWIND_ROW_INTERP:
+        case ATR_UNWIND_ROW_END:
+            break;
+
+        default:
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int
+ATR_file_map_cache(struct ATR *atr, struct ATR_file *fp)
+{
+    char *path = cache_path(atr, fp);
+    if (path == NULL) {
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    free(path);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 ||
+        st.st_size < (off_t)sizeof(struct ATR_cache_header))
+    {
+        close(fd);
+        return -1;
+    }
+
+    size_t length = st.st_size;
+    unsigned char *addr = mmap(0, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED) {
+        return -1;
+    }
+
+    struct ATR_cache_header *h = (struct ATR_cache_header*)addr;
+
+    if (memcmp(h->magic, ATR_CACHE_MAGIC, 8) != 0 ||
+        h->version != ATR_CACHE_VERSION ||
+        h->sym_index_entry_size != sizeof(struct ATR_sym_index_entry) ||
+        h->unwind_row_size != sizeof(struct ATR_unwind_row) ||
+        ((h->flags & ATR_CACHE_HAVE_SYM_INDEX) &&
+         (h->flags & ATR_CACHE_DEBUG_FILE_SYMTAB) != symtab_flags(fp)) ||
+        ! array_in_file(h->sym_index_offset, h->num_sym_index, sizeof(struct ATR_sym_index_entry), length) ||
+        ! array_in_file(h->unwind_table_offset, h->num_unwind_row, sizeof(struct ATR_unwind_row), length) ||
+        ! array_in_file(h->names_offset, h->names_length, 1, length) ||
+        (h->names_length != 0 && addr[h->names_offset + h->names_length - 1] != '\0') ||
+        ! cache_entries_valid(h, addr))
+    {
+        munmap(addr, length);
+        return -1;
+    }
+
+    fp->cache_addr = addr;
+    fp->cache_length = length;
+
+    if (h->flags & ATR_CACHE_HAVE_SYM_INDEX) {
+        fp->num_sym_index = h->num_sym_index;
+        fp->sym_index = (struct ATR_sym_index_entry*)(addr + h->sym_index_offset);
+        fp->sym_name_base = (char*)addr + h->names_offset;
+        fp->sym_index_built = 1;
+    }
+
+    if (h->flags & ATR_CACHE_HAVE_UNWIND_TABLE) {
+        fp->num_unwind_row = h->num_unwind_row;
+        fp->unwind_table = (struct ATR_unwind_row*)(addr + h->unwind_table_offset);
+        fp->unwind_table_built = 1;
+    }
+
+    return 0;
+}
+
+static int
+write_all(int fd, const void *p, size_t len)
+{
+    const char *cur = p;
+
+    while (len) {
+        ssize_t wr = write(fd, cur, len);
+        if (wr < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        cur += wr;
+        len -= wr;
+    }
+
+    return 0;
+}
+
+static int
+write_pad(int fd, uint64_t cur)
+{
+    static const char zero[8];
+    return write_all(fd, zero, ALIGN8(cur) - cur);
+}
+
+void
+ATR_file_store_cache(struct ATR *atr, struct ATR_file *fp)
+{
+    char *path = cache_path(atr, fp);
+    if (path == NULL) {
+        return;
+    }
+
+    /* names are copied from string tables of module, and offsets are
+     * rewritten to point them */
+    size_t num_sym = fp->sym_index_built ? fp->num_sym_index : 0;
+    size_t num_row = fp->unwind_table_built ? fp->num_unwind_row : 0;
+    struct ATR_sym_index_entry *sym_index = malloc(sizeof(*sym_index) * (num_sym ? num_sym : 1));
+    uint64_t names_length = 0;
+
+    for (size_t si=0; si<num_sym; si++) {
+        const char *name = ATR_file_sym_index_name(fp, si);
+        if (name == NULL) {
+            free(sym_index);
+            free(path);
+            return;
+        }
+
+        sym_index[si] = fp->sym_index[si];
+        sym_index[si].name = names_length;
+        names_length += strlen(name) + 1;
+    }
+
+    struct ATR_cache_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, ATR_CACHE_MAGIC, 8);
+    h.version = ATR_CACHE_VERSION;
+    h.sym_index_entry_size = sizeof(struct ATR_sym_index_entry);
+    h.unwind_row_size = sizeof(struct ATR_unwind_row);
+    if (fp->sym_index_built) {
+        h.flags |= ATR_CACHE_HAVE_SYM_INDEX | symtab_flags(fp);
+    }
+    if (fp->unwind_table_built) {
+        h.flags |= ATR_CACHE_HAVE_UNWIND_TABLE;
+    }
+
+    h.num_sym_index = num_sym;
+    h.sym_index_offset = ALIGN8(sizeof(h));
+
+    h.num_unwind_row = num_row;
+    h.unwind_table_offset = ALIGN8(h.sym_index_offset + num_sym * sizeof(struct ATR_sym_index_entry));
+
+    h.names_offset = ALIGN8(h.unwind_table_offset + num_row * sizeof(struct ATR_unwind_row));
+    h.names_length = names_length;
+
+    /* write to temporary file, and rename it. readers never see
+     * partially written cache */
+    size_t tmp_len = strlen(path) + 32;
+    char *tmp_path = malloc(tmp_len);
+    snprintf(tmp_path, tmp_len, "%s.%d.tmp", path, (int)getpid());
+
+    int fd = open(tmp_path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if (fd < 0 && errno == ENOENT) {
+        /* first store to cache_dir */
+        mkdir(atr->cache_dir, 0777);
+        fd = open(tmp_path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    }
+    if (fd < 0) {
+        goto fail_open;
+    }
+
+    int r = 0;
+    r |= write_all(fd, &h, sizeof(h));
+    r |= write_pad(fd, sizeof(h));
+
+    r |= write_all(fd, sym_index, num_sym * sizeof(struct ATR_sym_index_entry));
+    r |= write_pad(fd, h.sym_index_offset + num_sym * sizeof(struct ATR_sym_index_entry));
+
+    r |= write_all(fd, fp->unwind_table, num_row * sizeof(struct ATR_unwind_row));
+    r |= write_pad(fd, h.unwind_table_offset + num_row * sizeof(struct ATR_unwind_row));
+
+    for (size_t si=0; si<num_sym && r == 0; si++) {
+        const char *name = ATR_file_sym_index_name(fp, si);
+        r |= write_all(fd, name, strlen(name) + 1);
+    }
+
+    r |= close(fd);
+
+    if (r != 0 || rename(tmp_path, path) < 0) {
+        unlink(tmp_path);
+    }
+
+fail_open:
+    free(tmp_path);
+    free(sym_index);
+    free(path);
+}
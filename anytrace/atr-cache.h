@@ -0,0 +1,46 @@
+#ifndef ATR_CACHE_H
+#define ATR_CACHE_H
+
+#include <stdint.h>
+
+/* persistent cache of ATR_file (atr-cache.c).
+ *
+ *   <cache_dir>/<build id>.atrc
+ *
+ *   header
+ *   ATR_sym_index_entry[num_sym_index]   (name is offset in names)
+ *   ATR_unwind_row[num_unwind_row]
+ *   names (NUL terminated strings)
+ *
+ * each array is aligned to 8 byte.
+ * cache is written by same build of anytrace, so structs are stored as is.
+ * version and struct sizes are checked before use.
+ *
+ * tables are stored when they are built. a table that is not built yet
+ * is left out, and its flag is not set. */
+
+#define ATR_CACHE_MAGIC "ATRCACHE"
+#define ATR_CACHE_VERSION 2
+
+struct ATR_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint16_t sym_index_entry_size;
+    uint16_t unwind_row_size;
+
+#define ATR_CACHE_HAVE_SYM_INDEX (1<<0)
+#define ATR_CACHE_HAVE_UNWIND_TABLE (1<<1)
+#define ATR_CACHE_DEBUG_FILE_SYMTAB (1<<2) // sym_index is built from .symtab of debug file
+    uint32_t flags;
+
+    uint64_t num_sym_index;
+    uint64_t sym_index_offset;
+
+    uint64_t num_unwind_row;
+    uint64_t unwind_table_offset;
+
+    uint64_t names_offset;
+    uint64_t names_length;
+};
+
+#endif
@@ -7,16 +7,20 @@
 #include <string.h>
 #include <stdlib.h>
 #include <elf.h>
+#include <dwarf.h>
 #include <inttypes.h>
+#include <limits.h>
 
 #include "anytrace/atr.h"
 #include "anytrace/atr-file.h"
 #include "anytrace/atr-process.h"
 #include "anytrace/atr-backtrace.h"
+#include "anytrace/atr-impl.h"
 #include "config.h"
 
 #include "npr/mempool.h"
 #include "npr/symbol.h"
+#include "npr/red-black-tree.h"
 
 #if ANYTRACE_POINTER_SIZE == 8
 typedef Elf64_Ehdr Elf_Ehdr;
@@ -24,24 +28,254 @@ typedef Elf64_Shdr Elf_Shdr;
 typedef Elf64_Off Elf_Off;
 typedef Elf64_Half Elf_Half;
 typedef Elf64_Sym Elf_Sym;
+typedef Elf64_Phdr Elf_Phdr;
+typedef Elf64_Nhdr Elf_Nhdr;
+#define ELF_ST_TYPE ELF64_ST_TYPE
+#define ELF_ST_BIND ELF64_ST_BIND
 #else
 typedef Elf32_Ehdr Elf_Ehdr;
 typedef Elf32_Off Elf_Off;
 typedef Elf32_Shdr Elf_Shdr;
 typedef Elf32_Half Elf_Half;
 typedef Elf32_Sym Elf_Sym;
+typedef Elf32_Phdr Elf_Phdr;
+typedef Elf32_Nhdr Elf_Nhdr;
+#define ELF_ST_TYPE ELF32_ST_TYPE
+#define ELF_ST_BIND ELF32_ST_BIND
 #endif
 
+/* read [offset, offset+length) of file.
+ * return malloc-ed buffer, NULL if failed */
+static unsigned char *
+read_file_range(int fd,
+                size_t file_length,
+                uintptr_t offset,
+                size_t length)
+{
+    if (offset > file_length || length > file_length - offset) {
+        return NULL;
+    }
+
+    unsigned char *buf = malloc(length ? length : 1);
+    size_t done = 0;
+
+    while (done < length) {
+        ssize_t rd = pread(fd, buf + done, length - done, offset + done);
+        if (rd < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rd <= 0) {
+            free(buf);
+            return NULL;
+        }
+        done += rd;
+    }
+
+    return buf;
+}
+
+/* find NT_GNU_BUILD_ID in PT_NOTE segments.
+ * return hex string of it, NULL if not found */
+static struct npr_symbol *
+read_build_id(int fd,
+              size_t file_length,
+              Elf_Ehdr *ehdr,
+              unsigned char *phdrs)
+{
+    Elf_Half e_phentsize = ehdr->e_phentsize;
+    Elf_Half e_phnum = ehdr->e_phnum;
+
+    for (int pi=0; pi<e_phnum; pi++) {
+        Elf_Phdr *ph = (Elf_Phdr*)(phdrs + e_phentsize * pi);
+
+        if (ph->p_type != PT_NOTE) {
+            continue;
+        }
+
+        unsigned char *base = read_file_range(fd, file_length, ph->p_offset, ph->p_filesz);
+        if (base == NULL) {
+            continue;
+        }
+
+        uintptr_t cur = 0;
+        uintptr_t end = ph->p_filesz;
+
+        while (cur + sizeof(Elf_Nhdr) <= end) {
+            Elf_Nhdr *nh = (Elf_Nhdr*)(base + cur);
+            uintptr_t name = cur + sizeof(Elf_Nhdr);
+            uintptr_t desc = name + ((nh->n_namesz + 3) & ~3);
+
+            cur = desc + ((nh->n_descsz + 3) & ~3);
+            if (cur > end) {
+                break;
+            }
+
+            if (nh->n_type == NT_GNU_BUILD_ID &&
+                nh->n_namesz == 4 &&
+                memcmp(base + name, "GNU", 4) == 0 &&
+                nh->n_descsz > 0 && nh->n_descsz <= 64)
+            {
+                static const char hex[] = "0123456789abcdef";
+                char str[64*2+1];
+
+                for (unsigned int bi=0; bi<nh->n_descsz; bi++) {
+                    str[bi*2+0] = hex[base[desc+bi] >> 4];
+                    str[bi*2+1] = hex[base[desc+bi] & 0xf];
+                }
+                str[nh->n_descsz*2] = '\0';
+
+                free(base);
+                return npr_intern(str);
+            }
+        }
+
+        free(base);
+    }
+
+    return NULL;
+}
+
+/* build id of ELF file of fd, read without opening it as ATR_file.
+ * return NULL if not ELF, or build id is not found */
+static struct npr_symbol *
+peek_build_id(int fd, size_t file_length)
+{
+    Elf_Ehdr ehdr;
+    unsigned char *ident = read_file_range(fd, file_length, 0, sizeof(Elf_Ehdr));
+
+    if (ident == NULL ||
+        ident[0] != ELFMAG0 ||
+        ident[1] != ELFMAG1 ||
+        ident[2] != ELFMAG2 ||
+        ident[3] != ELFMAG3)
+    {
+        free(ident);
+        return NULL;
+    }
+
+    memcpy(&ehdr, ident, sizeof(Elf_Ehdr));
+    free(ident);
+
+    if (ehdr.e_phnum == 0 || ehdr.e_phentsize < sizeof(Elf_Phdr)) {
+        return NULL;
+    }
+
+    unsigned char *phdrs = read_file_range(fd, file_length, ehdr.e_phoff,
+                                           (size_t)ehdr.e_phentsize * ehdr.e_phnum);
+    if (phdrs == NULL) {
+        return NULL;
+    }
+
+    struct npr_symbol *build_id = read_build_id(fd, file_length, &ehdr, phdrs);
+    free(phdrs);
+
+    return build_id;
+}
+
+#define NUM_FILE_SECTION 15
+
+static void
+file_sections(struct ATR_section **list,
+              struct ATR_file *fp)
+{
+    list[0] = &fp->text;
+    list[1] = &fp->debug_abbrev;
+    list[2] = &fp->debug_info;
+    list[3] = &fp->eh_frame;
+    list[4] = &fp->eh_frame_hdr;
+    list[5] = &fp->symtab;
+    list[6] = &fp->strtab;
+    list[7] = &fp->dynsym;
+    list[8] = &fp->dynstr;
+    list[9] = &fp->debug_line;
+    list[10] = &fp->debug_line_str;
+    list[11] = &fp->debug_str;
+    list[12] = &fp->debug_aranges;
+    list[13] = &fp->debug_ranges;
+    list[14] = &fp->debug_rnglists;
+}
+
+static void
+init_section(struct ATR_section *s, int advice)
+{
+    s->length = 0;
+    s->start = 0;
+    s->vaddr = 0;
+    s->entsize = 0;
+    s->advice = advice;
+    s->data = NULL;
+    s->map_addr = NULL;
+    s->map_length = 0;
+}
+
+static void
+unmap_section(struct ATR_section *s)
+{
+    if (s->map_addr) {
+        munmap(s->map_addr, s->map_length);
+        s->map_addr = NULL;
+        s->map_length = 0;
+        s->data = NULL;
+    }
+}
+
+unsigned char *
+ATR_file_section_data(struct ATR_file *fp, struct ATR_section *s)
+{
+    if (s->data) {
+        return s->data;
+    }
+
+    if (s->length == 0 ||
+        s->start > fp->file_length ||
+        s->length > fp->file_length - s->start)
+    {
+        return NULL;
+    }
+
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t map_start = s->start & ~(page_size-1);
+    size_t map_length = s->start + s->length - map_start;
+
+    void *addr = mmap(0, map_length, PROT_READ, MAP_PRIVATE, fp->fd, map_start);
+    if (addr == MAP_FAILED) {
+        return NULL;
+    }
+
+    if (s->advice != MADV_NORMAL) {
+        madvise(addr, map_length, s->advice);
+    }
+
+    s->map_addr = addr;
+    s->map_length = map_length;
+    s->data = (unsigned char*)addr + (s->start - map_start);
+
+    return s->data;
+}
+
 int
 ATR_file_open(struct ATR_file *fp, struct ATR *atr, struct npr_symbol *path)
 {
     int fd = open(path->symstr, O_RDONLY);
 
-    if (fd < -1) {
+    if (fd == -1) {
         ATR_set_libc_path_error(atr, &atr->last_error, errno, path->symstr);
         return -1;
     }
 
+    return ATR_file_open_fd(fp, atr, path, fd);
+}
+
+/* read headers of ELF file, and initialize fp.
+ * name and crc of .gnu_debuglink are returned to debuglink (NULL if not found) */
+static int
+open_elf(struct ATR_file *fp,
+         struct ATR *atr,
+         struct npr_symbol *path,
+         int fd,
+         struct npr_symbol **debuglink,
+         uint32_t *debuglink_crc)
+{
     struct stat st;
     int r = fstat(fd, &st);
     if (r < 0) {
@@ -58,67 +292,132 @@ ATR_file_open(struct ATR_file *fp, struct ATR *atr, struct npr_symbol *path)
 
     size_t length = st.st_size;
 
-    void *mapped_addr = mmap(0, length, PROT_READ,
-                             MAP_PRIVATE, fd, 0);
-
-    if (mapped_addr == MAP_FAILED) {
-        close(fd);
-        ATR_set_libc_path_error(atr, &atr->last_error, errno, path->symstr);
-        return -1;
-    }
-
-    fp->fd = fd;
-    fp->mapped_length = length;
-    fp->mapped_addr = mapped_addr;
-
-    Elf_Ehdr *ehdr = (Elf_Ehdr*)mapped_addr;
+    /* only headers are read here. sections are mapped at first use */
+    Elf_Ehdr ehdr_buf;
+    Elf_Ehdr *ehdr = &ehdr_buf;
+    unsigned char *ident = read_file_range(fd, length, 0, sizeof(Elf_Ehdr));
 
-    if (ehdr->e_ident[0] != ELFMAG0 ||
-        ehdr->e_ident[1] != ELFMAG1 ||
-        ehdr->e_ident[2] != ELFMAG2 ||
-        ehdr->e_ident[3] != ELFMAG3)
+    if (ident == NULL ||
+        ident[0] != ELFMAG0 ||
+        ident[1] != ELFMAG1 ||
+        ident[2] != ELFMAG2 ||
+        ident[3] != ELFMAG3)
     {
-        munmap(fp->mapped_addr, fp->mapped_length);
+        free(ident);
         close(fd);
         ATR_set_unknown_mapped_file_type(atr, &atr->last_error, path->symstr);
 
         return -1;
     }
 
-    Elf_Off e_shoff = ehdr->e_shoff;
+    memcpy(ehdr, ident, sizeof(Elf_Ehdr));
+    free(ident);
+
+    fp->fd = fd;
+    fp->dev = st.st_dev;
+    fp->ino = st.st_ino;
+    fp->mtime_sec = st.st_mtim.tv_sec;
+    fp->mtime_nsec = st.st_mtim.tv_nsec;
+    fp->refcount = 0;
+    fp->cache_chain = NULL;
+    fp->file_length = length;
+
     Elf_Half e_shentsize = ehdr->e_shentsize;
     Elf_Half e_shnum =  ehdr->e_shnum;
     int str = ehdr->e_shstrndx;
 
-    unsigned char *base = (unsigned char*)mapped_addr;
-    Elf_Shdr *shstrtab = (Elf_Shdr*)(base + e_shoff + e_shentsize * str);
-
-    unsigned char *strtab = base + shstrtab->sh_offset;
-
-    fp->text.length = 0;
-    fp->debug_abbrev.length = 0;
-    fp->debug_info.length = 0;
-    fp->eh_frame.length = 0;
-    fp->symtab.length = 0;
-    fp->strtab.length = 0;
-    fp->dynsym.length = 0;
-    fp->dynstr.length = 0;
-
-    fp->text.start = 0;
-    fp->debug_abbrev.start = 0;
-    fp->debug_info.start = 0;
-    fp->eh_frame.start = 0;
-    fp->symtab.start = 0;
-    fp->strtab.start = 0;
-    fp->dynsym.start = 0;
-    fp->dynstr.start = 0;
+    unsigned char *shdrs = NULL, *strtab = NULL;
+    size_t strtab_length = 0;
+
+    if (e_shnum && e_shentsize >= sizeof(Elf_Shdr) && str < e_shnum) {
+        shdrs = read_file_range(fd, length, ehdr->e_shoff, (size_t)e_shentsize * e_shnum);
+    }
+
+    if (shdrs) {
+        Elf_Shdr *shstrtab = (Elf_Shdr*)(shdrs + e_shentsize * str);
+        strtab_length = shstrtab->sh_size;
+        strtab = read_file_range(fd, length, shstrtab->sh_offset, strtab_length);
+    }
+
+    unsigned char *phdrs = NULL;
+    if (ehdr->e_phnum && ehdr->e_phentsize >= sizeof(Elf_Phdr)) {
+        phdrs = read_file_range(fd, length, ehdr->e_phoff,
+                                (size_t)ehdr->e_phentsize * ehdr->e_phnum);
+    }
+
+    /* access pattern of each section */
+    init_section(&fp->text, MADV_RANDOM);               // peek at prologue
+    init_section(&fp->debug_abbrev, MADV_RANDOM);
+    init_section(&fp->debug_info, MADV_RANDOM);         // top DIE of CUs
+    init_section(&fp->eh_frame, MADV_RANDOM);           // FDE/CIE of each pc
+    init_section(&fp->eh_frame_hdr, MADV_WILLNEED);     // binary searched every frame
+    init_section(&fp->symtab, MADV_SEQUENTIAL);         // scanned once into sym_index
+    init_section(&fp->strtab, MADV_RANDOM);             // names of found symbols
+    init_section(&fp->dynsym, MADV_SEQUENTIAL);
+    init_section(&fp->dynstr, MADV_RANDOM);
+    init_section(&fp->debug_line, MADV_RANDOM);         // line program of one CU at a time
+    init_section(&fp->debug_line_str, MADV_RANDOM);
+    init_section(&fp->debug_str, MADV_RANDOM);
+    init_section(&fp->debug_aranges, MADV_SEQUENTIAL);  // scanned once into cu_ranges
+    init_section(&fp->debug_ranges, MADV_RANDOM);
+    init_section(&fp->debug_rnglists, MADV_RANDOM);
 
     fp->path = path;
+    fp->build_id = phdrs ? read_build_id(fd, length, ehdr, phdrs) : NULL;
+
+    fp->unwind_method = ATR_UNWIND_DEFAULT;
+
+    fp->sym_index_built = 0;
+    fp->num_sym_index = 0;
+    fp->sym_index = NULL;
+    fp->sym_name_base = NULL;
+    fp->sym_index_sym = NULL;
+
+    fp->cu_index_built = 0;
+    fp->num_cu = 0;
+    fp->cus = NULL;
+    fp->num_cu_range = 0;
+    fp->cu_ranges = NULL;
+    fp->abbrev_cache = NULL;
+
+    fp->debug_file = NULL;
+
+    fp->cache_length = 0;
+    fp->cache_addr = NULL;
 
-    for (int si=0; si<e_shnum; si++) {
-        Elf_Shdr *sh = (Elf_Shdr*)(base + e_shoff + e_shentsize * si);
+    fp->fde_index_built = 0;
+    fp->num_fde_index = 0;
+    fp->fde_index = NULL;
+
+    fp->cie_cache = NULL;
+
+    fp->unwind_memo = NULL;
+    fp->unwind_memo_num_set = 0;
+    fp->unwind_memo_clock = 0;
+
+    fp->unwind_table_built = 0;
+    fp->num_unwind_row = 0;
+    fp->unwind_table = NULL;
+
+    Elf_Shdr *debuglink_sh = NULL;
+
+    for (int si=0; strtab && si<e_shnum; si++) {
+        Elf_Shdr *sh = (Elf_Shdr*)(shdrs + e_shentsize * si);
+        if (sh->sh_name >= strtab_length) {
+            continue;
+        }
         char *name = (char*)(strtab + sh->sh_name);
 
+        /* sections of separate debug file other than debug info are
+         * NOBITS. compressed sections are not supported */
+        if (sh->sh_type == SHT_NOBITS || (sh->sh_flags & SHF_COMPRESSED)) {
+            continue;
+        }
+
+        if (strcmp(name, ".gnu_debuglink") == 0) {
+            debuglink_sh = sh;
+        }
+
 #define SET_SECTION(st_name, sec_name)               \
         if (strcmp(name,sec_name) == 0) {            \
             fp->st_name.length = sh->sh_size;        \
@@ -131,80 +430,2639 @@ ATR_file_open(struct ATR_file *fp, struct ATR *atr, struct npr_symbol *path)
         SET_SECTION(debug_abbrev, ".debug_abbrev");
         SET_SECTION(debug_info, ".debug_info");
         SET_SECTION(eh_frame, ".eh_frame");
+        SET_SECTION(eh_frame_hdr, ".eh_frame_hdr");
         SET_SECTION(symtab, ".symtab");
         SET_SECTION(dynsym, ".dynsym");
         SET_SECTION(strtab, ".strtab");
         SET_SECTION(dynstr, ".dynstr");
+        SET_SECTION(debug_line, ".debug_line");
+        SET_SECTION(debug_line_str, ".debug_line_str");
+        SET_SECTION(debug_str, ".debug_str");
+        SET_SECTION(debug_aranges, ".debug_aranges");
+        SET_SECTION(debug_ranges, ".debug_ranges");
+        SET_SECTION(debug_rnglists, ".debug_rnglists");
+    }
+
+    if (fp->eh_frame_hdr.length == 0 && phdrs) {
+        /* section headers may be stripped. PT_GNU_EH_FRAME is always there */
+        Elf_Half e_phentsize = ehdr->e_phentsize;
+        Elf_Half e_phnum = ehdr->e_phnum;
+
+        for (int pi=0; pi<e_phnum; pi++) {
+            Elf_Phdr *ph = (Elf_Phdr*)(phdrs + e_phentsize * pi);
+
+            if (ph->p_type == PT_GNU_EH_FRAME) {
+                fp->eh_frame_hdr.length = ph->p_filesz;
+                fp->eh_frame_hdr.start = ph->p_offset;
+                fp->eh_frame_hdr.entsize = 0;
+                fp->eh_frame_hdr.vaddr = ph->p_vaddr;
+                break;
+            }
+        }
+    }
+
+    /* .gnu_debuglink : file name, padding to 4 byte, crc32 */
+    *debuglink = NULL;
+    *debuglink_crc = 0;
+
+    if (debuglink_sh) {
+        size_t len = debuglink_sh->sh_size;
+        unsigned char *link = read_file_range(fd, length, debuglink_sh->sh_offset, len);
+
+        if (link) {
+            size_t name_len = strnlen((char*)link, len);
+            size_t crc_off = (name_len + 4) & ~(size_t)3;
+
+            if (name_len > 0 && crc_off + 4 <= len) {
+                *debuglink = npr_intern((char*)link);
+                memcpy(debuglink_crc, link + crc_off, 4);
+            }
+            free(link);
+        }
+    }
+
+    free(shdrs);
+    free(strtab);
+    free(phdrs);
+
+    return 0;
+}
+
+static void find_debug_file(struct ATR *atr,
+                            struct ATR_file *fp,
+                            struct npr_symbol *debuglink,
+                            uint32_t debuglink_crc);
+
+int
+ATR_file_open_fd(struct ATR_file *fp, struct ATR *atr, struct npr_symbol *path, int fd)
+{
+    struct npr_symbol *debuglink;
+    uint32_t debuglink_crc;
+
+    if (open_elf(fp, atr, path, fd, &debuglink, &debuglink_crc) < 0) {
+        return -1;
+    }
+
+    if (fp->debug_info.length == 0) {
+        find_debug_file(atr, fp, debuglink, debuglink_crc);
+    }
+
+    /* tables that are not in cache are built and stored at first use */
+    if (atr->cache_dir && fp->build_id) {
+        ATR_file_map_cache(atr, fp);
     }
 
     return 0;
 }
 
+static void
+free_cie_cache_node(struct npr_rbtree_node *n, void *arg)
+{
+    free((void*)n->v);
+}
+
+static void free_abbrev_cache_node(struct npr_rbtree_node *n, void *arg);
+
+/* table in persistent cache is not malloc-ed */
+static int
+is_cache_data(struct ATR_file *fp, void *p)
+{
+    unsigned char *c = p;
+    return fp->cache_addr && c >= fp->cache_addr && c <= fp->cache_addr + fp->cache_length;
+}
+
 void
 ATR_file_close(struct ATR *atr, struct ATR_file *fp)
 {
-    munmap(fp->mapped_addr, fp->mapped_length);
+    if (fp->cie_cache) {
+        npr_rbtree_traverse(fp->cie_cache, free_cie_cache_node, NULL);
+        npr_rbtree_fini(fp->cie_cache);
+        free(fp->cie_cache);
+    }
+
+    if (! is_cache_data(fp, fp->sym_index)) {
+        free(fp->sym_index);
+    }
+    if (! is_cache_data(fp, fp->unwind_table)) {
+        free(fp->unwind_table);
+    }
+    if (fp->cache_addr) {
+        munmap(fp->cache_addr, fp->cache_length);
+    }
+
+    for (size_t ci=0; ci<fp->num_cu; ci++) {
+        struct ATR_line_table *lt = fp->cus[ci].lines;
+        if (lt) {
+            free(lt->rows);
+            free(lt->files);
+            free(lt);
+        }
+
+        free(fp->cus[ci].inlines);
+        free(fp->cus[ci].inline_max_end);
+    }
+    free(fp->cus);
+    free(fp->cu_ranges);
+
+    if (fp->abbrev_cache) {
+        npr_rbtree_traverse(fp->abbrev_cache, free_abbrev_cache_node, NULL);
+        npr_rbtree_fini(fp->abbrev_cache);
+        free(fp->abbrev_cache);
+    }
+
+    free(fp->unwind_memo);
+    free(fp->sym_index_sym);
+    free(fp->fde_index);
+
+    struct ATR_section *sections[NUM_FILE_SECTION];
+    file_sections(sections, fp);
+    for (int si=0; si<NUM_FILE_SECTION; si++) {
+        unmap_section(sections[si]);
+    }
+
+    if (fp->debug_file) {
+        ATR_file_close(atr, fp->debug_file);
+        free(fp->debug_file);
+    }
+
     close(fp->fd);
 }
 
-static int
-lookup_symtab(struct ATR_addr_info *info,
-              struct ATR_section *s,
-              struct ATR_section *str,
-              unsigned char *base,
-              uintptr_t pc)
+void
+ATR_file_cache_init(struct ATR *atr)
 {
-    if (str->length == 0) {
-        return -1;
-    }
-    char *strbase = (char*)base + str->start;
+    npr_symtab_init(&atr->impl->file_cache, 16);
+    npr_symtab_init(&atr->impl->build_id_cache, 16);
+    npr_symtab_init(&atr->impl->debug_file_cache, 16);
+}
 
-    if (s->length) {
-        uintptr_t sptr = s->start;
-        uintptr_t end = sptr + s->length;
-        unsigned int entsize = s->entsize;
+void
+ATR_file_cache_fini(struct ATR *atr)
+{
+    struct npr_symtab *tab = &atr->impl->file_cache;
 
-        while (sptr < end) {
-            Elf_Sym *sym = (Elf_Sym*)(base + sptr);
+    for (int bi=0; bi<tab->num_bin; bi++) {
+        struct npr_symtab_entry *e = tab->entries[bi];
 
-            if (pc >= sym->st_value &&
-                pc < (sym->st_value + sym->st_size))
-            {
-                info->flags |= ATR_ADDR_INFO_HAVE_SYMBOL;
-                info->sym = npr_intern(strbase + sym->st_name);
-                info->sym_offset = pc - sym->st_value;
+        while (e) {
+            struct ATR_file *fp = e->data;
 
-                return 0;
+            while (fp) {
+                struct ATR_file *next = fp->cache_chain;
+                ATR_file_close(atr, fp);
+                free(fp);
+                fp = next;
             }
 
-            sptr += entsize;
+            e = e->chain;
         }
     }
 
-    return -1;
+    npr_symtab_fini(tab);
+    npr_symtab_fini(&atr->impl->build_id_cache);
+
+    tab = &atr->impl->debug_file_cache;
+    for (int bi=0; bi<tab->num_bin; bi++) {
+        for (struct npr_symtab_entry *e = tab->entries[bi]; e; e = e->chain) {
+            free(e->data);
+        }
+    }
+    npr_symtab_fini(tab);
+}
+
+struct ATR_file *
+ATR_file_lookup_cache(struct ATR *atr,
+                      struct npr_symbol *path,
+                      const struct stat *st)
+{
+    struct npr_symtab_entry *e;
+    e = npr_symtab_lookup_entry(&atr->impl->file_cache,
+                                path,
+                                NPR_LOOKUP_FAIL);
+    if (e == NULL) {
+        return NULL;
+    }
+
+    /* cached file keeps its fd, so (dev, ino) can't be reused
+     * by another file while it is in cache. but file may be
+     * rewritten in place, so mtime is compared too */
+    for (struct ATR_file *fp = e->data; fp; fp = fp->cache_chain) {
+        if (fp->dev == (uint64_t)st->st_dev &&
+            fp->ino == (uint64_t)st->st_ino &&
+            fp->mtime_sec == st->st_mtim.tv_sec &&
+            fp->mtime_nsec == st->st_mtim.tv_nsec)
+        {
+            fp->refcount++;
+            return fp;
+        }
+    }
+
+    return NULL;
+}
+
+struct ATR_file *
+ATR_file_acquire(struct ATR *atr, struct npr_symbol *path)
+{
+    int fd = open(path->symstr, O_RDONLY);
+    if (fd == -1) {
+        ATR_set_libc_path_error(atr, &atr->last_error, errno, path->symstr);
+        return NULL;
+    }
+
+    return ATR_file_acquire_fd(atr, path, fd);
 }
 
+struct ATR_file *
+ATR_file_acquire_fd(struct ATR *atr, struct npr_symbol *path, int fd)
+{
+    struct stat st;
+    int r = fstat(fd, &st);
+    if (r < 0) {
+        ATR_set_libc_path_error(atr, &atr->last_error, errno, path->symstr);
+        close(fd);
+        return NULL;
+    }
+
+    struct ATR_file *fp = ATR_file_lookup_cache(atr, path, &st);
+    if (fp) {
+        close(fd);
+        return fp;
+    }
+
+    /* same binary is opened from another path (or another mount
+     * namespace). share it with its caches. only notes are read to
+     * find it, before sections, debug file and persistent cache */
+    struct npr_symbol *build_id = peek_build_id(fd, st.st_size);
+    if (build_id) {
+        struct npr_symtab_entry *be;
+        be = npr_symtab_lookup_entry(&atr->impl->build_id_cache,
+                                     build_id,
+                                     NPR_LOOKUP_FAIL);
+
+        if (be && be->data) {
+            close(fd);
+
+            fp = be->data;
+            fp->refcount++;
+            return fp;
+        }
+    }
+
+    fp = malloc(sizeof(*fp));
+    r = ATR_file_open_fd(fp, atr, path, fd);
+    if (r < 0) {
+        free(fp);
+        return NULL;
+    }
+
+    if (fp->build_id) {
+        struct npr_symtab_entry *be;
+        be = npr_symtab_lookup_entry(&atr->impl->build_id_cache,
+                                     fp->build_id,
+                                     NPR_LOOKUP_APPEND);
+        be->data = fp;
+    }
+
+    struct npr_symtab_entry *e;
+    e = npr_symtab_lookup_entry(&atr->impl->file_cache,
+                                path,
+                                NPR_LOOKUP_APPEND);
+
+    fp->refcount = 1;
+    fp->cache_chain = e->data;
+    e->data = fp;
+
+    return fp;
+}
 
 void
-ATR_file_lookup_addr_info(struct ATR_addr_info *info,
-                          struct ATR *atr,
-                          struct ATR_backtracer *tr)
+ATR_file_release(struct ATR *atr, struct ATR_file *fp)
 {
-    info->flags = 0;
+    fp->refcount--;
+    if (fp->refcount > 0) {
+        return;
+    }
 
-    struct ATR_file *fp = &tr->current_module;
-    uintptr_t pc = tr->pc_offset_in_module-fp->text.start + fp->text.vaddr;
+    struct npr_symtab_entry *e;
+    e = npr_symtab_lookup_entry(&atr->impl->file_cache,
+                                fp->path,
+                                NPR_LOOKUP_FAIL);
+
+    struct ATR_file *prev = NULL, *cur = e->data;
+    while (cur != fp) {
+        prev = cur;
+        cur = cur->cache_chain;
+    }
+
+    if (prev) {
+        prev->cache_chain = fp->cache_chain;
+    } else {
+        e->data = fp->cache_chain;
+    }
+
+    if (fp->build_id) {
+        e = npr_symtab_lookup_entry(&atr->impl->build_id_cache,
+                                    fp->build_id,
+                                    NPR_LOOKUP_FAIL);
+        if (e && e->data == fp) {
+            e->data = NULL;
+        }
+    }
+
+    ATR_file_close(atr, fp);
+    free(fp);
+}
+
+/* result of separate debug file lookup (ATR_impl::debug_file_cache) */
+struct debug_file_cache_entry {
+    struct npr_symbol *path;    // NULL : not found
+
+    /* identity of verified file. verification is skipped while
+     * file is not changed */
+    uint64_t dev, ino;
+    int64_t mtime_sec, mtime_nsec;
+};
+
+/* crc32 of .gnu_debuglink (same as zlib).
+ * table[i] is crc of byte i, polynomial 0xedb88320 */
+static const uint32_t debuglink_crc_table[256] = {
+    0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
+    0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
+    0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
+    0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
+    0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9,
+    0xfa0f3d63, 0x8d080df5, 0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
+    0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b, 0x35b5a8fa, 0x42b2986c,
+    0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
+    0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
+    0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
+    0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d, 0x76dc4190, 0x01db7106,
+    0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
+    0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
+    0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
+    0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
+    0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
+    0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
+    0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
+    0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
+    0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
+    0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
+    0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
+    0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
+    0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
+    0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
+    0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
+    0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
+    0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
+    0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
+    0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
+    0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
+    0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
+    0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
+    0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
+    0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
+    0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
+    0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
+    0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
+    0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
+    0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
+    0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
+    0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
+    0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
+};
+
+static uint32_t
+debuglink_crc32(int fd, int *err)
+{
+    uint32_t crc = 0xffffffff;
+    unsigned char buf[65536];
+    off_t offset = 0;
+
+    *err = 0;
+
+    while (1) {
+        ssize_t rd = pread(fd, buf, sizeof(buf), offset);
+        if (rd < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rd < 0) {
+            *err = 1;
+            break;
+        }
+        if (rd == 0) {
+            break;
+        }
+
+        for (ssize_t i=0; i<rd; i++) {
+            crc = debuglink_crc_table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+        }
+        offset += rd;
+    }
+
+    return crc ^ 0xffffffff;
+}
 
-    unsigned char *base = fp->mapped_addr;
+/* open path as debug file of fp.
+ * file found by build id must have same build id, file found by
+ * debuglink must have same crc. verification is skipped if c has
+ * same identity.
+ * return 0 if fp->debug_file is set */
+static int
+open_debug_file(struct ATR *atr,
+                struct ATR_file *fp,
+                const char *path,
+                int by_build_id,
+                uint32_t debuglink_crc,
+                struct debug_file_cache_entry *c)
+{
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || ! S_ISREG(st.st_mode) ||
+        ((uint64_t)st.st_dev == fp->dev && (uint64_t)st.st_ino == fp->ino))
+    {
+        close(fd);
+        return -1;
+    }
+
+    int verified = (c->path &&
+                    strcmp(c->path->symstr, path) == 0 &&
+                    c->dev == (uint64_t)st.st_dev &&
+                    c->ino == (uint64_t)st.st_ino &&
+                    c->mtime_sec == st.st_mtim.tv_sec &&
+                    c->mtime_nsec == st.st_mtim.tv_nsec);
+
+    if (! verified && ! by_build_id) {
+        int err;
+        uint32_t crc = debuglink_crc32(fd, &err);
+        if (err || crc != debuglink_crc) {
+            close(fd);
+            return -1;
+        }
+    }
 
-    int r = lookup_symtab(info, &fp->symtab, &fp->strtab, base, pc);
-    if (r == -1) {
-        lookup_symtab(info, &fp->dynsym, &fp->dynstr, base, pc);
+    struct ATR_file *dfp = malloc(sizeof(*dfp));
+    struct npr_symbol *debuglink;
+    uint32_t crc;
+
+    if (open_elf(dfp, atr, npr_intern(path), fd, &debuglink, &crc) < 0) {
+        /* not fatal. module is used without debug file */
+        ATR_error_clear(atr, &atr->last_error);
+        free(dfp);
+        return -1;
     }
 
-    /* 1. .debug_info (not yet)
-     * 2. .symtab
-     * 3. .dynsym (not yet)
+    if (! verified && fp->build_id && dfp->build_id != fp->build_id &&
+        (by_build_id || dfp->build_id))
+    {
+        ATR_file_close(atr, dfp);
+        free(dfp);
+        return -1;
+    }
+
+    fp->debug_file = dfp;
+
+    c->path = dfp->path;
+    c->dev = st.st_dev;
+    c->ino = st.st_ino;
+    c->mtime_sec = st.st_mtim.tv_sec;
+    c->mtime_nsec = st.st_mtim.tv_nsec;
+
+    return 0;
+}
+
+/* find separate debug file of fp, in the same order as gdb
+ *
+ *   1. <debug_dir>/.build-id/xx/yyyy.debug
+ *   2. <dir of fp>/<debuglink>
+ *   3. <dir of fp>/.debug/<debuglink>
+ *   4. <debug_dir>/<dir of fp>/<debuglink>
+ *
+ * result (and failure) is cached by build id (or debuglink and its crc),
+ * so paths are probed once even if module is opened again */
+static void
+find_debug_file(struct ATR *atr,
+                struct ATR_file *fp,
+                struct npr_symbol *debuglink,
+                uint32_t debuglink_crc)
+{
+    if (atr->debug_dir == NULL) {
+        return;
+    }
+
+    struct npr_symbol *key;
+    char buf[PATH_MAX*2 + 64];
+
+    if (fp->build_id) {
+        key = fp->build_id;
+    } else if (debuglink) {
+        snprintf(buf, sizeof(buf), "%s:%08x", debuglink->symstr, (unsigned int)debuglink_crc);
+        key = npr_intern(buf);
+    } else {
+        return;
+    }
+
+    struct npr_symtab_entry *e;
+    e = npr_symtab_lookup_entry(&atr->impl->debug_file_cache,
+                                key,
+                                NPR_LOOKUP_APPEND);
+
+    struct debug_file_cache_entry *c = e->data;
+
+    if (c) {
+        if (c->path == NULL) {
+            return;
+        }
+
+        /* found by build id if its path is under .build-id */
+        int by_build_id = (fp->build_id && strstr(c->path->symstr, "/.build-id/"));
+        if (open_debug_file(atr, fp, c->path->symstr, by_build_id, debuglink_crc, c) == 0) {
+            return;
+        }
+
+        /* removed or changed. search again */
+    } else {
+        c = malloc(sizeof(*c));
+        e->data = c;
+    }
+
+    c->path = NULL;
+
+    const char *id = fp->build_id ? fp->build_id->symstr : NULL;
+    if (id && strlen(id) > 2) {
+        snprintf(buf, sizeof(buf), "%s/.build-id/%.2s/%s.debug",
+                 atr->debug_dir, id, id + 2);
+        if (open_debug_file(atr, fp, buf, 1, 0, c) == 0) {
+            return;
+        }
+    }
+
+    if (debuglink == NULL) {
+        return;
+    }
+
+    const char *path = fp->path->symstr;
+    const char *slash = strrchr(path, '/');
+    int dir_len = slash ? (int)(slash - path) : 0;
+
+    if (dir_len >= PATH_MAX) {
+        return;
+    }
+
+    if (slash) {
+        snprintf(buf, sizeof(buf), "%.*s/%s", dir_len, path, debuglink->symstr);
+    } else {
+        snprintf(buf, sizeof(buf), "%s", debuglink->symstr);
+    }
+    if (open_debug_file(atr, fp, buf, 0, debuglink_crc, c) == 0) {
+        return;
+    }
+
+    if (slash) {
+        snprintf(buf, sizeof(buf), "%.*s/.debug/%s", dir_len, path, debuglink->symstr);
+    } else {
+        snprintf(buf, sizeof(buf), ".debug/%s", debuglink->symstr);
+    }
+    if (open_debug_file(atr, fp, buf, 0, debuglink_crc, c) == 0) {
+        return;
+    }
+
+    if (path[0] == '/') {
+        snprintf(buf, sizeof(buf), "%s%.*s/%s",
+                 atr->debug_dir, dir_len, path, debuglink->symstr);
+        open_debug_file(atr, fp, buf, 0, debuglink_crc, c);
+    }
+}
+
+struct ATR_file *
+ATR_file_symbol_file(struct ATR_file *fp)
+{
+    if (fp->debug_file && fp->debug_file->symtab.length) {
+        return fp->debug_file;
+    }
+
+    return fp;
+}
+
+/* file that has DWARF of fp */
+static struct ATR_file *
+dwarf_file(struct ATR_file *fp)
+{
+    if (fp->debug_file && fp->debug_file->debug_info.length) {
+        return fp->debug_file;
+    }
+
+    return fp;
+}
+
+/* candidate of sym_index. aliases are sorted by priority */
+struct sym_index_cand {
+    uintptr_t addr;
+    uintptr_t size;
+    uintptr_t name;             // offset in file
+    int prio;
+    size_t seq;
+};
+
+static int
+cmp_sym_index_cand(const void *a, const void *b)
+{
+    const struct sym_index_cand *ca = a;
+    const struct sym_index_cand *cb = b;
+
+    if (ca->addr != cb->addr) {
+        return (ca->addr < cb->addr) ? -1 : 1;
+    }
+    if (ca->prio != cb->prio) {
+        return (ca->prio > cb->prio) ? -1 : 1;
+    }
+    if (ca->seq != cb->seq) {
+        return (ca->seq < cb->seq) ? -1 : 1;
+    }
+    return 0;
+}
+
+static void
+collect_sym_index_cand(struct npr_varray *cands,
+                       struct ATR_file *fp,
+                       struct ATR_section *s,
+                       struct ATR_section *str)
+{
+    if (s->length == 0 || str->length == 0 || s->entsize == 0) {
+        return;
+    }
+
+    unsigned char *base = ATR_file_section_data(fp, s);
+    if (base == NULL) {
+        return;
+    }
+
+    uintptr_t sptr = 0;
+    uintptr_t end = s->length;
+    unsigned int entsize = s->entsize;
+
+    while (sptr + entsize <= end) {
+        Elf_Sym *sym = (Elf_Sym*)(base + sptr);
+        int type = ELF_ST_TYPE(sym->st_info);
+        int bind = ELF_ST_BIND(sym->st_info);
+
+        sptr += entsize;
+
+        if ((type != STT_FUNC && type != STT_GNU_IFUNC) ||
+            sym->st_shndx == SHN_UNDEF ||
+            sym->st_value == 0 ||
+            sym->st_name >= str->length)
+        {
+            continue;
+        }
+
+        struct sym_index_cand *c;
+        VA_NEWELEM_LASTPTR(struct sym_index_cand, cands, c);
+
+        c->addr = sym->st_value;
+        c->size = sym->st_size;
+        c->name = str->start + sym->st_name;
+        c->seq = cands->nelem;
+
+        /* alias with size > global > weak > local.
+         * .symtab comes first, so it wins over .dynsym */
+        c->prio = (sym->st_size != 0) * 4;
+        if (bind == STB_GLOBAL) {
+            c->prio += 2;
+        } else if (bind == STB_WEAK) {
+            c->prio += 1;
+        }
+    }
+}
+
+/* merge .symtab and .dynsym into sorted table that has one entry per address */
+void
+ATR_file_build_sym_index(struct ATR *atr, struct ATR_file *fp)
+{
+    if (fp->sym_index_built) {
+        return;
+    }
+
+    struct npr_varray cands;
+    npr_varray_init(&cands, 64, sizeof(struct sym_index_cand));
+
+    /* .symtab of debug file has symbols of .dynsym too */
+    struct ATR_file *sfp = ATR_file_symbol_file(fp);
+
+    collect_sym_index_cand(&cands, sfp, &sfp->symtab, &sfp->strtab);
+    collect_sym_index_cand(&cands, sfp, &sfp->dynsym, &sfp->dynstr);
+
+    /* symbol tables are not used after this */
+    unmap_section(&sfp->symtab);
+    unmap_section(&sfp->dynsym);
+
+    size_t num_cand = cands.nelem;
+    struct sym_index_cand *c = npr_varray_malloc_close(&cands);
+
+    qsort(c, num_cand, sizeof(struct sym_index_cand), cmp_sym_index_cand);
+
+    struct ATR_sym_index_entry *index;
+    size_t n = 0;
+
+    index = malloc(sizeof(struct ATR_sym_index_entry) * (num_cand ? num_cand : 1));
+
+    for (size_t ci=0; ci<num_cand; ci++) {
+        if (ci > 0 && c[ci].addr == c[ci-1].addr) {
+            /* alias of previous (higher priority) entry */
+            continue;
+        }
+
+        struct ATR_sym_index_entry *e = &index[n++];
+        e->addr = c[ci].addr;
+        e->end = c[ci].addr + c[ci].size;
+        e->name = c[ci].name;
+    }
+
+    /* zero-size symbol (hand-written asm) covers until next symbol */
+    for (size_t ei=0; ei<n; ei++) {
+        if (index[ei].end == index[ei].addr) {
+            if (ei+1 < n) {
+                index[ei].end = index[ei+1].addr;
+            } else {
+                index[ei].end = index[ei].addr + 1;
+            }
+        }
+    }
+
+    free(c);
+
+    fp->num_sym_index = n;
+    fp->sym_index = index;
+    fp->sym_name_base = NULL;
+    fp->sym_index_built = 1;
+
+    ATR_file_store_cache(atr, fp);
+}
+
+const char *
+ATR_file_sym_index_name(struct ATR_file *fp, size_t idx)
+{
+    uintptr_t name = fp->sym_index[idx].name;
+
+    if (fp->sym_name_base) {
+        return fp->sym_name_base + name;
+    }
+
+    struct ATR_file *sfp = ATR_file_symbol_file(fp);
+    struct ATR_section *str = &sfp->strtab;
+    if (name < str->start || name >= str->start + str->length) {
+        str = &sfp->dynstr;
+    }
+
+    unsigned char *data = ATR_file_section_data(sfp, str);
+    if (data == NULL) {
+        return NULL;
+    }
+
+    return (char*)data + (name - str->start);
+}
+
+#define SYM_INDEX_MAX_NEST 8
+
+/* return 0 if found, -1 if not found */
+static int
+lookup_sym_index(struct ATR_addr_info *info,
+                 struct ATR *atr,
+                 struct ATR_file *fp,
+                 uintptr_t pc)
+{
+    ATR_file_build_sym_index(atr, fp);
+
+    /* find last entry that satisfies addr <= pc */
+    size_t lo = 0, hi = fp->num_sym_index;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi-lo)/2;
+
+        if (fp->sym_index[mid].addr <= pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    /* sized symbols may be nested (e.g. local label inside function).
+     * look back a few entries for the one that still covers pc */
+    for (int back=0; back<SYM_INDEX_MAX_NEST && lo > 0; back++) {
+        struct ATR_sym_index_entry *e = &fp->sym_index[lo-1];
+
+        if (pc < e->end) {
+            if (fp->sym_index_sym == NULL) {
+                fp->sym_index_sym = calloc(fp->num_sym_index, sizeof(struct npr_symbol*));
+            }
+
+            struct npr_symbol **sym = &fp->sym_index_sym[lo-1];
+            if (*sym == NULL) {
+                const char *name = ATR_file_sym_index_name(fp, lo-1);
+                if (name == NULL) {
+                    return -1;
+                }
+                *sym = npr_intern(name);
+            }
+
+            info->flags |= ATR_ADDR_INFO_HAVE_SYMBOL;
+            info->sym = *sym;
+            info->sym_offset = pc - e->addr;
+            return 0;
+        }
+
+        lo--;
+    }
+
+    return -1;
+}
+
+/* bounds checked reader of DWARF sections.
+ * on overrun, err is set and 0 is returned */
+struct dwarf_reader {
+    const unsigned char *base;
+    uintptr_t cur, end;
+    int err;
+};
+
+static void
+dwarf_reader_init(struct dwarf_reader *r,
+                  const unsigned char *base,
+                  uintptr_t cur,
+                  uintptr_t end)
+{
+    r->base = base;
+    r->cur = cur;
+    r->end = end;
+    r->err = 0;
+}
+
+static int
+dwarf_check(struct dwarf_reader *r, uintptr_t n)
+{
+    if (r->err || r->cur > r->end || n > r->end - r->cur) {
+        r->err = 1;
+        return -1;
+    }
+    return 0;
+}
+
+static void
+dwarf_skip(struct dwarf_reader *r, uintptr_t n)
+{
+    if (dwarf_check(r, n) == 0) {
+        r->cur += n;
+    }
+}
+
+static uint64_t
+dwarf_read_n(struct dwarf_reader *r, int n)
+{
+    if (dwarf_check(r, n) < 0) {
+        return 0;
+    }
+
+    uint64_t v = 0;
+    for (int bi=0; bi<n; bi++) {
+        v |= (uint64_t)r->base[r->cur + bi] << (bi*8);
+    }
+    r->cur += n;
+    return v;
+}
+
+static uint64_t
+dwarf_read_uleb(struct dwarf_reader *r)
+{
+    uint64_t v = 0;
+    int shift = 0;
+
+    while (dwarf_check(r, 1) == 0) {
+        unsigned char b = r->base[r->cur++];
+        if (shift < 64) {
+            v |= (uint64_t)(b & 0x7f) << shift;
+        }
+        shift += 7;
+        if ((b & 0x80) == 0) {
+            break;
+        }
+    }
+
+    return v;
+}
+
+static int64_t
+dwarf_read_sleb(struct dwarf_reader *r)
+{
+    int64_t v = 0;
+    int shift = 0;
+    unsigned char b = 0;
+
+    while (dwarf_check(r, 1) == 0) {
+        b = r->base[r->cur++];
+        if (shift < 64) {
+            v |= (int64_t)(b & 0x7f) << shift;
+        }
+        shift += 7;
+        if ((b & 0x80) == 0) {
+            break;
+        }
+    }
+
+    if (shift < 64 && (b & 0x40)) {
+        v |= -((int64_t)1 << shift);
+    }
+
+    return v;
+}
+
+/* return NULL if not terminated */
+static const char *
+dwarf_read_cstr(struct dwarf_reader *r)
+{
+    if (dwarf_check(r, 1) < 0) {
+        return NULL;
+    }
+
+    const char *s = (const char*)r->base + r->cur;
+    const void *nul = memchr(s, '\0', r->end - r->cur);
+    if (nul == NULL) {
+        r->err = 1;
+        return NULL;
+    }
+
+    r->cur += ((const char*)nul - s) + 1;
+    return s;
+}
+
+/* read initial length. set *offset_size (4 or 8), and return length */
+static uint64_t
+dwarf_read_initial_length(struct dwarf_reader *r, int *offset_size)
+{
+    uint64_t length = dwarf_read_n(r, 4);
+
+    if (length == 0xffffffff) {
+        *offset_size = 8;
+        return dwarf_read_n(r, 8);
+    }
+
+    *offset_size = 4;
+    return length;
+}
+
+/* string at offset in .debug_str or .debug_line_str. NULL if invalid */
+static const char *
+dwarf_section_str(struct ATR_file *fp,
+                  struct ATR_section *s,
+                  uint64_t offset)
+{
+    unsigned char *data = ATR_file_section_data(fp, s);
+    if (data == NULL || offset >= s->length) {
+        return NULL;
+    }
+
+    const char *str = (const char*)data + offset;
+    if (memchr(str, '\0', s->length - offset) == NULL) {
+        return NULL;
+    }
+
+    return str;
+}
+
+/* unit parameters used to read attribute values */
+struct dwarf_unit_param {
+    int version;
+    int offset_size;
+    int address_size;
+};
+
+/* value of attribute. str is set for string forms that can be resolved */
+struct dwarf_attr_value {
+    uint64_t u;
+    const char *str;
+};
+
+/* read value of form. forms that need base of other sections
+ * (strx, addrx, ...) are skipped, and str is NULL.
+ * return -1 if form is unknown */
+static int
+dwarf_read_form(struct dwarf_attr_value *v,
+                struct dwarf_reader *r,
+                struct ATR_file *fp,
+                const struct dwarf_unit_param *up,
+                uint64_t form,
+                int64_t implicit_const)
+{
+    v->u = 0;
+    v->str = NULL;
+
+    switch (form) {
+    case DW_FORM_addr:
+        v->u = dwarf_read_n(r, up->address_size);
+        break;
+
+    case DW_FORM_flag:
+    case DW_FORM_data1:
+    case DW_FORM_ref1:
+    case DW_FORM_strx1:
+    case DW_FORM_addrx1:
+        v->u = dwarf_read_n(r, 1);
+        break;
+
+    case DW_FORM_data2:
+    case DW_FORM_ref2:
+    case DW_FORM_strx2:
+    case DW_FORM_addrx2:
+        v->u = dwarf_read_n(r, 2);
+        break;
+
+    case DW_FORM_strx3:
+    case DW_FORM_addrx3:
+        v->u = dwarf_read_n(r, 3);
+        break;
+
+    case DW_FORM_data4:
+    case DW_FORM_ref4:
+    case DW_FORM_ref_sup4:
+    case DW_FORM_strx4:
+    case DW_FORM_addrx4:
+        v->u = dwarf_read_n(r, 4);
+        break;
+
+    case DW_FORM_data8:
+    case DW_FORM_ref8:
+    case DW_FORM_ref_sig8:
+    case DW_FORM_ref_sup8:
+        v->u = dwarf_read_n(r, 8);
+        break;
+
+    case DW_FORM_data16:
+        dwarf_skip(r, 16);
+        break;
+
+    case DW_FORM_sdata:
+        v->u = dwarf_read_sleb(r);
+        break;
+
+    case DW_FORM_udata:
+    case DW_FORM_ref_udata:
+    case DW_FORM_strx:
+    case DW_FORM_addrx:
+    case DW_FORM_loclistx:
+    case DW_FORM_rnglistx:
+    case DW_FORM_GNU_addr_index:
+    case DW_FORM_GNU_str_index:
+        v->u = dwarf_read_uleb(r);
+        break;
+
+    case DW_FORM_string:
+        v->str = dwarf_read_cstr(r);
+        break;
+
+    case DW_FORM_strp:
+        v->u = dwarf_read_n(r, up->offset_size);
+        v->str = dwarf_section_str(fp, &fp->debug_str, v->u);
+        break;
+
+    case DW_FORM_line_strp:
+        v->u = dwarf_read_n(r, up->offset_size);
+        v->str = dwarf_section_str(fp, &fp->debug_line_str, v->u);
+        break;
+
+    case DW_FORM_ref_addr:
+        /* DWARF 2 uses address size */
+        v->u = dwarf_read_n(r, (up->version <= 2) ? up->address_size : up->offset_size);
+        break;
+
+    case DW_FORM_sec_offset:
+    case DW_FORM_strp_sup:
+    case DW_FORM_GNU_ref_alt:
+    case DW_FORM_GNU_strp_alt:
+        v->u = dwarf_read_n(r, up->offset_size);
+        break;
+
+    case DW_FORM_block1:
+        dwarf_skip(r, dwarf_read_n(r, 1));
+        break;
+
+    case DW_FORM_block2:
+        dwarf_skip(r, dwarf_read_n(r, 2));
+        break;
+
+    case DW_FORM_block4:
+        dwarf_skip(r, dwarf_read_n(r, 4));
+        break;
+
+    case DW_FORM_block:
+    case DW_FORM_exprloc:
+        dwarf_skip(r, dwarf_read_uleb(r));
+        break;
+
+    case DW_FORM_flag_present:
+        v->u = 1;
+        break;
+
+    case DW_FORM_implicit_const:
+        v->u = implicit_const;
+        break;
+
+    case DW_FORM_indirect: {
+        uint64_t real_form = dwarf_read_uleb(r);
+        if (real_form == DW_FORM_indirect || real_form == DW_FORM_implicit_const) {
+            return -1;
+        }
+        return dwarf_read_form(v, r, fp, up, real_form, 0);
+    }
+
+    default:
+        return -1;
+    }
+
+    return r->err ? -1 : 0;
+}
+
+/* position of abbrev declaration of code in abbrev table at abbrev_offset.
+ * reader is set at first attribute spec. return tag, 0 if not found */
+static uint64_t
+dwarf_find_abbrev(struct dwarf_reader *ar,
+                  int *has_children,
+                  struct ATR_file *fp,
+                  uint64_t abbrev_offset,
+                  uint64_t code)
+{
+    unsigned char *abbrev = ATR_file_section_data(fp, &fp->debug_abbrev);
+    if (abbrev == NULL) {
+        return 0;
+    }
+
+    dwarf_reader_init(ar, abbrev, abbrev_offset, fp->debug_abbrev.length);
+
+    while (1) {
+        uint64_t c = dwarf_read_uleb(ar);
+        if (c == 0 || ar->err) {
+            return 0;
+        }
+
+        uint64_t tag = dwarf_read_uleb(ar);
+        *has_children = dwarf_read_n(ar, 1);
+
+        if (c == code) {
+            return tag;
+        }
+
+        /* skip attribute specs */
+        while (! ar->err) {
+            uint64_t name = dwarf_read_uleb(ar);
+            uint64_t form = dwarf_read_uleb(ar);
+            if (form == DW_FORM_implicit_const) {
+                dwarf_read_sleb(ar);
+            }
+            if (name == 0 && form == 0) {
+                break;
+            }
+        }
+    }
+}
+
+/* read unit header at offset of .debug_info.
+ * set *die at first DIE, *next at next unit.
+ * return -1 if invalid, 1 if unit is not compile/partial unit */
+static int
+dwarf_read_unit_header(struct dwarf_unit_param *up,
+                       uint64_t *abbrev_offset,
+                       struct dwarf_reader *die,
+                       uint64_t *next,
+                       struct ATR_file *fp,
+                       uint64_t offset)
+{
+    unsigned char *info = ATR_file_section_data(fp, &fp->debug_info);
+    if (info == NULL) {
+        return -1;
+    }
+
+    struct dwarf_reader r;
+    dwarf_reader_init(&r, info, offset, fp->debug_info.length);
+
+    uint64_t length = dwarf_read_initial_length(&r, &up->offset_size);
+    if (r.err || length > r.end - r.cur) {
+        return -1;
+    }
+
+    uintptr_t end = r.cur + length;
+    *next = end;
+    r.end = end;
+
+    up->version = dwarf_read_n(&r, 2);
+    int unit_type = DW_UT_compile;
+
+    if (up->version >= 5) {
+        unit_type = dwarf_read_n(&r, 1);
+        up->address_size = dwarf_read_n(&r, 1);
+        *abbrev_offset = dwarf_read_n(&r, up->offset_size);
+    } else if (up->version >= 2) {
+        *abbrev_offset = dwarf_read_n(&r, up->offset_size);
+        up->address_size = dwarf_read_n(&r, 1);
+    } else {
+        return -1;
+    }
+
+    if (r.err || up->address_size < 1 || up->address_size > 8) {
+        return -1;
+    }
+
+    if (unit_type != DW_UT_compile && unit_type != DW_UT_partial) {
+        return 1;
+    }
+
+    *die = r;
+    return 0;
+}
+
+/* attributes of DIE used by CU and inline index */
+struct dwarf_die {
+    uint64_t tag;
+    int has_children;
+
+    uint64_t low_pc, high_pc;
+    int have_low_pc, have_high_pc, high_pc_is_offset;
+
+    uint64_t ranges;
+    uint64_t ranges_form;       // 0 if DW_AT_ranges is not found
+
+    uint64_t origin;            // absolute offset in .debug_info. 0 if not found
+    uint64_t call_file, call_line;
+    uint64_t rnglists_base;
+
+    const char *name, *linkage_name;
+};
+
+static void read_die_ranges(struct npr_varray *ranges,
+                            const struct ATR_inline_range *proto,
+                            struct ATR_file *fp,
+                            const struct dwarf_unit_param *up,
+                            const struct dwarf_die *die,
+                            uint64_t cu_base,
+                            uint64_t rnglists_base);
+static void push_cu_range(struct npr_varray *ranges,
+                          uint64_t begin,
+                          uint64_t end,
+                          size_t cu);
+
+/* read attributes of top DIE of CU at offset.
+ * address ranges of CU (DW_AT_low_pc/high_pc, or DW_AT_ranges) are
+ * pushed to ranges as cu_index */
+static int
+read_cu_top_die(struct ATR_cu *cu,
+                struct npr_varray *ranges,
+                size_t cu_index,
+                uint64_t *next,
+                struct ATR_file *fp,
+                uint64_t offset)
+{
+    struct dwarf_unit_param up;
+    uint64_t abbrev_offset;
+    struct dwarf_reader r, ar;
+
+    cu->offset = offset;
+    cu->stmt_list = (uint64_t)-1;
+    cu->comp_dir = NULL;
+    cu->lines_decoded = 0;
+    cu->lines = NULL;
+    cu->inlines_decoded = 0;
+    cu->num_inline = 0;
+    cu->inlines = NULL;
+    cu->inline_max_end = NULL;
+
+    int ret = dwarf_read_unit_header(&up, &abbrev_offset, &r, next, fp, offset);
+    if (ret != 0) {
+        return ret;
+    }
+
+    int has_children;
+    uint64_t code = dwarf_read_uleb(&r);
+    uint64_t tag = dwarf_find_abbrev(&ar, &has_children, fp, abbrev_offset, code);
+
+    if (tag != DW_TAG_compile_unit && tag != DW_TAG_partial_unit) {
+        return 1;
+    }
+
+    struct dwarf_die die;
+    memset(&die, 0, sizeof(die));
+
+    while (! ar.err && ! r.err) {
+        uint64_t name = dwarf_read_uleb(&ar);
+        uint64_t form = dwarf_read_uleb(&ar);
+        int64_t implicit_const = 0;
+
+        if (form == DW_FORM_implicit_const) {
+            implicit_const = dwarf_read_sleb(&ar);
+        }
+        if (name == 0 && form == 0) {
+            break;
+        }
+
+        struct dwarf_attr_value v;
+        if (dwarf_read_form(&v, &r, fp, &up, form, implicit_const) < 0) {
+            return -1;
+        }
+
+        switch (name) {
+        case DW_AT_stmt_list:
+            cu->stmt_list = v.u;
+            break;
+
+        case DW_AT_comp_dir:
+            if (v.str) {
+                cu->comp_dir = npr_intern(v.str);
+            }
+            break;
+
+        case DW_AT_low_pc:
+            /* DW_FORM_addrx needs .debug_addr. not supported */
+            if (form == DW_FORM_addr) {
+                die.low_pc = v.u;
+                die.have_low_pc = 1;
+            }
+            break;
+
+        case DW_AT_high_pc:
+            if (form == DW_FORM_addr) {
+                die.high_pc = v.u;
+                die.have_high_pc = 1;
+            } else if (form != DW_FORM_addrx && form != DW_FORM_GNU_addr_index &&
+                       (form < DW_FORM_addrx1 || form > DW_FORM_addrx4))
+            {
+                /* DWARF 4 : constant class is offset from low_pc */
+                die.high_pc = v.u;
+                die.high_pc_is_offset = 1;
+                die.have_high_pc = 1;
+            }
+            break;
+
+        case DW_AT_ranges:
+            die.ranges = v.u;
+            die.ranges_form = form;
+            break;
+
+        case DW_AT_rnglists_base:
+            die.rnglists_base = v.u;
+            break;
+        }
+    }
+
+    if (die.have_low_pc && die.have_high_pc) {
+        uint64_t end = die.high_pc_is_offset ? die.low_pc + die.high_pc : die.high_pc;
+        push_cu_range(ranges, die.low_pc, end, cu_index);
+    } else if (die.ranges_form) {
+        /* non-contiguous CU (e.g. hot/cold split functions) */
+        struct npr_varray die_ranges;
+        struct ATR_inline_range proto;
+
+        memset(&proto, 0, sizeof(proto));
+        npr_varray_init(&die_ranges, 16, sizeof(struct ATR_inline_range));
+
+        read_die_ranges(&die_ranges, &proto, fp, &up, &die,
+                        die.have_low_pc ? die.low_pc : 0,
+                        die.rnglists_base);
+
+        struct ATR_inline_range *dr = (struct ATR_inline_range*)die_ranges.elements;
+        for (size_t ri=0; ri<die_ranges.nelem; ri++) {
+            push_cu_range(ranges, dr[ri].begin, dr[ri].end, cu_index);
+        }
+
+        npr_varray_discard(&die_ranges);
+    }
+
+    return 0;
+}
+
+static int
+cmp_cu_range(const void *a, const void *b)
+{
+    const struct ATR_cu_range *ra = a;
+    const struct ATR_cu_range *rb = b;
+
+    if (ra->begin < rb->begin) {
+        return -1;
+    }
+    if (ra->begin > rb->begin) {
+        return 1;
+    }
+    return 0;
+}
+
+static void
+push_cu_range(struct npr_varray *ranges,
+              uint64_t begin,
+              uint64_t end,
+              size_t cu)
+{
+    if (begin >= end) {
+        return;
+    }
+
+    struct ATR_cu_range *range;
+    VA_NEWELEM_LASTPTR(struct ATR_cu_range, ranges, range);
+    range->begin = begin;
+    range->end = end;
+    range->cu = cu;
+}
+
+/* return index of cu at offset, or (size_t)-1 */
+static size_t
+find_cu_by_offset(struct ATR_file *fp, uint64_t offset)
+{
+    size_t lo = 0, hi = fp->num_cu;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi-lo)/2;
+
+        if (fp->cus[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < fp->num_cu && fp->cus[lo].offset == offset) {
+        return lo;
+    }
+    return (size_t)-1;
+}
+
+/* read .debug_aranges into ranges. return -1 if not available */
+static int
+read_aranges(struct npr_varray *ranges,
+             struct ATR_file *fp)
+{
+    unsigned char *data = ATR_file_section_data(fp, &fp->debug_aranges);
+    if (data == NULL) {
+        return -1;
+    }
+
+    struct dwarf_reader r;
+    dwarf_reader_init(&r, data, 0, fp->debug_aranges.length);
+
+    while (r.cur < r.end && ! r.err) {
+        int offset_size;
+        uintptr_t set_start = r.cur;
+        uint64_t length = dwarf_read_initial_length(&r, &offset_size);
+        if (r.err || length > r.end - r.cur) {
+            break;
+        }
+
+        uintptr_t set_end = r.cur + length;
+
+        struct dwarf_reader sr = r;
+        sr.end = set_end;
+
+        dwarf_read_n(&sr, 2);   // version
+        uint64_t cu_offset = dwarf_read_n(&sr, offset_size);
+        int address_size = dwarf_read_n(&sr, 1);
+        int seg_size = dwarf_read_n(&sr, 1);
+
+        size_t cu = find_cu_by_offset(fp, cu_offset);
+
+        /* tuples are aligned to twice of address size from start of set */
+        uintptr_t tuple_size = address_size * 2;
+        uintptr_t header_size = sr.cur - set_start;
+        if (tuple_size && header_size % tuple_size) {
+            dwarf_skip(&sr, tuple_size - header_size % tuple_size);
+        }
+
+        while (! sr.err && sr.cur < sr.end && address_size > 0 && address_size <= 8) {
+            dwarf_skip(&sr, seg_size);
+            uint64_t addr = dwarf_read_n(&sr, address_size);
+            uint64_t len = dwarf_read_n(&sr, address_size);
+
+            if (addr == 0 && len == 0) {
+                break;
+            }
+
+            if (cu != (size_t)-1) {
+                push_cu_range(ranges, addr, addr + len, cu);
+            }
+        }
+
+        r.cur = set_end;
+    }
+
+    return 0;
+}
+
+/* list CUs of .debug_info, and sort address ranges of them */
+static void
+build_cu_index(struct ATR_file *fp)
+{
+    fp->cu_index_built = 1;
+
+    if (fp->debug_info.length == 0) {
+        return;
+    }
+
+    struct npr_varray cus, ranges, top_ranges;
+    npr_varray_init(&cus, 16, sizeof(struct ATR_cu));
+    npr_varray_init(&ranges, 16, sizeof(struct ATR_cu_range));
+    npr_varray_init(&top_ranges, 16, sizeof(struct ATR_cu_range));
+
+    uint64_t offset = 0;
+
+    while (offset < fp->debug_info.length) {
+        struct ATR_cu cu;
+        uint64_t next;
+        size_t num_top_range = top_ranges.nelem;
+
+        int r = read_cu_top_die(&cu, &top_ranges, cus.nelem, &next, fp, offset);
+        if (r < 0) {
+            top_ranges.nelem = num_top_range;
+            break;
+        }
+
+        if (r == 0) {
+            VA_PUSH(struct ATR_cu, &cus, cu);
+        } else {
+            top_ranges.nelem = num_top_range;
+        }
+
+        offset = next;
+    }
+
+    fp->num_cu = cus.nelem;
+    fp->cus = npr_varray_malloc_close(&cus);
+
+    if (read_aranges(&ranges, fp) < 0 || ranges.nelem == 0) {
+        /* no .debug_aranges (e.g. clang). use ranges of top DIE of CU.
+         * line programs are decoded at lookup (lookup_line) */
+        npr_varray_discard(&ranges);
+        ranges = top_ranges;
+    } else {
+        npr_varray_discard(&top_ranges);
+    }
+
+    fp->num_cu_range = ranges.nelem;
+    fp->cu_ranges = npr_varray_malloc_close(&ranges);
+
+    qsort(fp->cu_ranges, fp->num_cu_range,
+          sizeof(struct ATR_cu_range),
+          cmp_cu_range);
+}
+
+/* return NULL if pc is not covered by any CU */
+static struct ATR_cu *
+lookup_cu(struct ATR_file *fp,
+          uintptr_t pc)
+{
+    if (! fp->cu_index_built) {
+        build_cu_index(fp);
+    }
+
+    /* find last range that satisfies begin <= pc */
+    size_t lo = 0, hi = fp->num_cu_range;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi-lo)/2;
+
+        if (fp->cu_ranges[mid].begin <= pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0 || pc >= fp->cu_ranges[lo-1].end) {
+        return NULL;
+    }
+
+    return &fp->cus[fp->cu_ranges[lo-1].cu];
+}
+
+/* join dir and name into interned path */
+static struct npr_symbol *
+intern_path(const char *dir,
+            const char *name)
+{
+    if (name == NULL) {
+        return NULL;
+    }
+
+    if (name[0] == '/' || dir == NULL || dir[0] == '\0') {
+        return npr_intern(name);
+    }
+
+    size_t dir_len = strlen(dir);
+    size_t name_len = strlen(name);
+    char *buf = malloc(dir_len + 1 + name_len + 1);
+
+    memcpy(buf, dir, dir_len);
+    buf[dir_len] = '/';
+    memcpy(buf + dir_len + 1, name, name_len + 1);
+
+    struct npr_symbol *sym = npr_intern(buf);
+    free(buf);
+
+    return sym;
+}
+
+/* read directory/file entry table of DWARF 5 line header.
+ * path of each entry is pushed to paths (const char*), directory index to dirs */
+static int
+read_line_entry_table(struct npr_varray *paths,
+                      struct npr_varray *dirs,
+                      struct dwarf_reader *r,
+                      struct ATR_file *fp,
+                      const struct dwarf_unit_param *up)
+{
+    int format_count = dwarf_read_n(r, 1);
+    uint64_t formats[32][2];
+
+    if (format_count > 32) {
+        return -1;
+    }
+
+    for (int fi=0; fi<format_count; fi++) {
+        formats[fi][0] = dwarf_read_uleb(r);
+        formats[fi][1] = dwarf_read_uleb(r);
+    }
+
+    uint64_t count = dwarf_read_uleb(r);
+
+    for (uint64_t ei=0; ei<count && ! r->err; ei++) {
+        const char *path = NULL;
+        uint64_t dir = 0;
+
+        for (int fi=0; fi<format_count; fi++) {
+            struct dwarf_attr_value v;
+            if (dwarf_read_form(&v, r, fp, up, formats[fi][1], 0) < 0) {
+                return -1;
+            }
+
+            if (formats[fi][0] == DW_LNCT_path) {
+                path = v.str;
+            } else if (formats[fi][0] == DW_LNCT_directory_index) {
+                dir = v.u;
+            }
+        }
+
+        VA_PUSH(const char *, paths, path);
+        if (dirs) {
+            VA_PUSH(uint64_t, dirs, dir);
+        }
+    }
+
+    return r->err ? -1 : 0;
+}
+
+static int
+cmp_line_row(const void *a, const void *b)
+{
+    const struct ATR_line_row *ra = a;
+    const struct ATR_line_row *rb = b;
+
+    if (ra->addr != rb->addr) {
+        return (ra->addr < rb->addr) ? -1 : 1;
+    }
+
+    /* end of previous sequence comes before start of next one */
+    if ((ra->line == 0) != (rb->line == 0)) {
+        return (ra->line == 0) ? -1 : 1;
+    }
+    return 0;
+}
+
+/* decode line program of cu into cu->lines */
+static void
+build_line_table(struct ATR_file *fp,
+                 struct ATR_cu *cu)
+{
+    cu->lines_decoded = 1;
+
+    unsigned char *data = ATR_file_section_data(fp, &fp->debug_line);
+    if (data == NULL || cu->stmt_list >= fp->debug_line.length) {
+        return;
+    }
+
+    struct dwarf_reader r;
+    dwarf_reader_init(&r, data, cu->stmt_list, fp->debug_line.length);
+
+    struct dwarf_unit_param up;
+    uint64_t unit_length = dwarf_read_initial_length(&r, &up.offset_size);
+    if (r.err || unit_length > r.end - r.cur) {
+        return;
+    }
+    r.end = r.cur + unit_length;
+
+    up.version = dwarf_read_n(&r, 2);
+    up.address_size = sizeof(uintptr_t);
+
+    if (up.version < 2 || up.version > 5) {
+        return;
+    }
+
+    if (up.version >= 5) {
+        up.address_size = dwarf_read_n(&r, 1);
+        dwarf_read_n(&r, 1);    // segment_selector_size
+    }
+
+    if (up.address_size < 1 || up.address_size > 8) {
+        return;
+    }
+
+    uint64_t header_length = dwarf_read_n(&r, up.offset_size);
+    uintptr_t program = r.cur + header_length;
+
+    int min_inst_length = dwarf_read_n(&r, 1);
+    if (up.version >= 4) {
+        dwarf_read_n(&r, 1);    // maximum_operations_per_instruction (VLIW only)
+    }
+    int default_is_stmt = dwarf_read_n(&r, 1);
+    int line_base = (int8_t)dwarf_read_n(&r, 1);
+    int line_range = dwarf_read_n(&r, 1);
+    int opcode_base = dwarf_read_n(&r, 1);
+
+    unsigned char std_opcode_lengths[256];
+    for (int oi=1; oi<opcode_base; oi++) {
+        std_opcode_lengths[oi] = dwarf_read_n(&r, 1);
+    }
+
+    if (r.err || line_range == 0) {
+        return;
+    }
+
+    /* include directories and file names */
+    struct npr_varray dir_paths, file_paths, file_dirs;
+    npr_varray_init(&dir_paths, 16, sizeof(const char *));
+    npr_varray_init(&file_paths, 16, sizeof(const char *));
+    npr_varray_init(&file_dirs, 16, sizeof(uint64_t));
+
+    const char *comp_dir = cu->comp_dir ? cu->comp_dir->symstr : NULL;
+
+    if (up.version >= 5) {
+        if (read_line_entry_table(&dir_paths, NULL, &r, fp, &up) < 0 ||
+            read_line_entry_table(&file_paths, &file_dirs, &r, fp, &up) < 0)
+        {
+            goto fail;
+        }
+    } else {
+        /* index 0 is directory of CU, file index starts from 1 */
+        VA_PUSH(const char *, &dir_paths, comp_dir);
+        VA_PUSH(const char *, &file_paths, NULL);
+        VA_PUSH(uint64_t, &file_dirs, 0);
+
+        while (1) {
+            const char *dir = dwarf_read_cstr(&r);
+            if (dir == NULL || dir[0] == '\0') {
+                break;
+            }
+            VA_PUSH(const char *, &dir_paths, dir);
+        }
+
+        while (1) {
+            const char *name = dwarf_read_cstr(&r);
+            if (name == NULL || name[0] == '\0') {
+                break;
+            }
+            uint64_t dir = dwarf_read_uleb(&r);
+            dwarf_read_uleb(&r);    // mtime
+            dwarf_read_uleb(&r);    // length
+
+            VA_PUSH(const char *, &file_paths, name);
+            VA_PUSH(uint64_t, &file_dirs, dir);
+        }
+    }
+
+    if (r.err) {
+        goto fail;
+    }
+
+    /* run line number program */
+    struct npr_varray rows;
+    npr_varray_init(&rows, 64, sizeof(struct ATR_line_row));
+
+    r.cur = program;
+
+    uint64_t address = 0;
+    uint64_t file = 1;
+    int64_t line = 1;
+    int is_stmt = default_is_stmt;
+    int last_is_stmt = 0;
+
+    /* rows of same address in a sequence are merged to last one.
+     * but is_stmt row is kept over following non-stmt row, because
+     * it is statement boundary that debuggers report */
+#define EMIT_ROW(row_line) do {                                         \
+        struct ATR_line_row *row;                                       \
+        if ((row_line) != 0 && rows.nelem > 0 &&                        \
+            VA_TOP(struct ATR_line_row, &rows).addr == address &&       \
+            VA_TOP(struct ATR_line_row, &rows).line != 0)               \
+        {                                                               \
+            if (last_is_stmt && ! is_stmt) {                            \
+                break;                                                  \
+            }                                                           \
+            row = VA_LAST_PTR(struct ATR_line_row, &rows);              \
+        } else {                                                        \
+            VA_NEWELEM_LASTPTR(struct ATR_line_row, &rows, row);        \
+        }                                                               \
+        row->addr = address;                                            \
+        row->file = file;                                               \
+        row->line = (row_line);                                         \
+        last_is_stmt = is_stmt;                                         \
+    } while (0)
+
+    while (r.cur < r.end && ! r.err) {
+        int op = dwarf_read_n(&r, 1);
+
+        if (op >= opcode_base) {
+            int adj = op - opcode_base;
+            address += (adj / line_range) * min_inst_length;
+            line += line_base + (adj % line_range);
+            EMIT_ROW(line > 0 ? line : 1);
+            continue;
+        }
+
+        switch (op) {
+        case 0: {
+            uint64_t len = dwarf_read_uleb(&r);
+            uintptr_t next = r.cur + len;
+            if (len == 0) {
+                break;
+            }
+
+            int sub = dwarf_read_n(&r, 1);
+
+            switch (sub) {
+            case DW_LNE_end_sequence:
+                EMIT_ROW(0);
+                address = 0;
+                file = 1;
+                line = 1;
+                is_stmt = default_is_stmt;
+                break;
+
+            case DW_LNE_set_address:
+                /* operand wider than uint64_t is skipped */
+                if (len - 1 <= 8) {
+                    address = dwarf_read_n(&r, len - 1);
+                }
+                break;
+
+            case DW_LNE_define_file: {
+                const char *name = dwarf_read_cstr(&r);
+                uint64_t dir = dwarf_read_uleb(&r);
+                VA_PUSH(const char *, &file_paths, name);
+                VA_PUSH(uint64_t, &file_dirs, dir);
+                break;
+            }
+            }
+
+            r.cur = next;
+            break;
+        }
+
+        case DW_LNS_copy:
+            EMIT_ROW(line > 0 ? line : 1);
+            break;
+
+        case DW_LNS_advance_pc:
+            address += dwarf_read_uleb(&r) * min_inst_length;
+            break;
+
+        case DW_LNS_advance_line:
+            line += dwarf_read_sleb(&r);
+            break;
+
+        case DW_LNS_set_file:
+            file = dwarf_read_uleb(&r);
+            break;
+
+        case DW_LNS_negate_stmt:
+            is_stmt = ! is_stmt;
+            break;
+
+        case DW_LNS_const_add_pc:
+            address += ((255 - opcode_base) / line_range) * min_inst_length;
+            break;
+
+        case DW_LNS_fixed_advance_pc:
+            address += dwarf_read_n(&r, 2);
+            break;
+
+        default:
+            /* set_column, set_isa, and unknown standard opcodes */
+            for (int ai=0; ai<std_opcode_lengths[op]; ai++) {
+                dwarf_read_uleb(&r);
+            }
+            break;
+        }
+    }
+
+#undef EMIT_ROW
+
+    /* compact : sort, and keep last row of same address */
+    size_t num_row = rows.nelem;
+    struct ATR_line_row *row = npr_varray_malloc_close(&rows);
+    size_t n = 0;
+
+    qsort(row, num_row, sizeof(struct ATR_line_row), cmp_line_row);
+
+    for (size_t ri=0; ri<num_row; ri++) {
+        if (n > 0 && row[n-1].addr == row[ri].addr &&
+            (row[n-1].line != 0) == (row[ri].line != 0))
+        {
+            row[n-1] = row[ri];
+        } else {
+            row[n++] = row[ri];
+        }
+    }
+
+    /* intern file names */
+    const char **dirs = (const char**)dir_paths.elements;
+    const char **paths = (const char**)file_paths.elements;
+    uint64_t *file_dir = (uint64_t*)file_dirs.elements;
+
+    struct ATR_line_table *lt = malloc(sizeof(struct ATR_line_table));
+    lt->num_row = n;
+    lt->rows = row;
+    lt->num_file = file_paths.nelem;
+    lt->files = malloc(sizeof(struct npr_symbol*) * (lt->num_file ? lt->num_file : 1));
+
+    for (size_t fi=0; fi<lt->num_file; fi++) {
+        const char *dir = NULL;
+        if (file_dir[fi] < dir_paths.nelem) {
+            dir = dirs[file_dir[fi]];
+        }
+
+        if (dir && dir[0] != '/' && comp_dir) {
+            struct npr_symbol *abs_dir = intern_path(comp_dir, dir);
+            lt->files[fi] = intern_path(abs_dir->symstr, paths[fi]);
+        } else {
+            lt->files[fi] = intern_path(dir, paths[fi]);
+        }
+    }
+
+    cu->lines = lt;
+
+fail:
+    npr_varray_discard(&dir_paths);
+    npr_varray_discard(&file_paths);
+    npr_varray_discard(&file_dirs);
+}
+
+/* return 0 if found, -1 if not found */
+static int
+lookup_line(struct ATR_addr_info *info,
+            struct ATR_file *fp,
+            uintptr_t pc)
+{
+    struct ATR_cu *cu = lookup_cu(fp, pc);
+    if (cu == NULL) {
+        return -1;
+    }
+
+    if (! cu->lines_decoded) {
+        build_line_table(fp, cu);
+    }
+
+    struct ATR_line_table *lt = cu->lines;
+    if (lt == NULL) {
+        return -1;
+    }
+
+    /* find last row that satisfies addr <= pc */
+    size_t lo = 0, hi = lt->num_row;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi-lo)/2;
+
+        if (lt->rows[mid].addr <= pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0) {
+        return -1;
+    }
+
+    struct ATR_line_row *row = &lt->rows[lo-1];
+    if (row->line == 0 ||
+        row->file >= lt->num_file ||
+        lt->files[row->file] == NULL)
+    {
+        return -1;
+    }
+
+    info->flags |= ATR_ADDR_INFO_HAVE_LOCATION;
+    info->source_path = lt->files[row->file];
+    info->lineno = row->line;
+
+    return 0;
+}
+
+/* decoded abbrev table of a unit. (ATR_file::abbrev_cache) */
+struct dwarf_abbrev {
+    uint64_t tag;               // 0 if code is not declared
+    int has_children;
+    uintptr_t spec;             // offset of attribute specs in .debug_abbrev
+};
+
+struct dwarf_abbrev_table {
+    uint64_t num_code;          // abbrevs[code], 0 <= code < num_code
+    struct dwarf_abbrev *abbrevs;
+};
+
+/* codes are dense in practice. larger codes are not supported */
+#define DWARF_MAX_ABBREV_CODE 65536
+
+/* return NULL if invalid */
+static struct dwarf_abbrev_table *
+get_abbrev_table(struct ATR_file *fp,
+                 uint64_t abbrev_offset)
+{
+    if (fp->abbrev_cache == NULL) {
+        fp->abbrev_cache = malloc(sizeof(struct npr_rbtree));
+        npr_rbtree_init(fp->abbrev_cache);
+    }
+
+    struct npr_rbtree_node *n = npr_rbtree_find(fp->abbrev_cache, abbrev_offset);
+    if (n) {
+        return (struct dwarf_abbrev_table*)n->v;
+    }
+
+    unsigned char *data = ATR_file_section_data(fp, &fp->debug_abbrev);
+    if (data == NULL) {
+        return NULL;
+    }
+
+    struct npr_varray abbrevs;
+    npr_varray_init(&abbrevs, 64, sizeof(struct dwarf_abbrev));
+
+    struct dwarf_reader r;
+    dwarf_reader_init(&r, data, abbrev_offset, fp->debug_abbrev.length);
+
+    while (! r.err) {
+        uint64_t code = dwarf_read_uleb(&r);
+        if (code == 0 || code >= DWARF_MAX_ABBREV_CODE) {
+            break;
+        }
+
+        while (abbrevs.nelem <= code) {
+            struct dwarf_abbrev *a;
+            VA_NEWELEM_LASTPTR(struct dwarf_abbrev, &abbrevs, a);
+            a->tag = 0;
+            a->has_children = 0;
+            a->spec = 0;
+        }
+
+        struct dwarf_abbrev *a = &((struct dwarf_abbrev*)abbrevs.elements)[code];
+        a->tag = dwarf_read_uleb(&r);
+        a->has_children = dwarf_read_n(&r, 1);
+        a->spec = r.cur;
+
+        while (! r.err) {
+            uint64_t name = dwarf_read_uleb(&r);
+            uint64_t form = dwarf_read_uleb(&r);
+            if (form == DW_FORM_implicit_const) {
+                dwarf_read_sleb(&r);
+            }
+            if (name == 0 && form == 0) {
+                break;
+            }
+        }
+    }
+
+    struct dwarf_abbrev_table *t = malloc(sizeof(struct dwarf_abbrev_table));
+    t->num_code = abbrevs.nelem;
+    t->abbrevs = npr_varray_malloc_close(&abbrevs);
+
+    npr_rbtree_insert(fp->abbrev_cache, abbrev_offset, (uintptr_t)t);
+
+    return t;
+}
+
+static void
+free_abbrev_cache_node(struct npr_rbtree_node *n, void *arg)
+{
+    struct dwarf_abbrev_table *t = (struct dwarf_abbrev_table*)n->v;
+    free(t->abbrevs);
+    free(t);
+}
+
+/* read DIE at r. *code is 0 for null entry.
+ * return -1 if invalid */
+static int
+dwarf_read_die(struct dwarf_die *die,
+               uint64_t *code,
+               struct dwarf_reader *r,
+               struct ATR_file *fp,
+               const struct dwarf_unit_param *up,
+               struct dwarf_abbrev_table *abbrevs,
+               uint64_t unit_offset)
+{
+    *code = dwarf_read_uleb(r);
+    if (r->err) {
+        return -1;
+    }
+    if (*code == 0) {
+        return 0;
+    }
+    if (*code >= abbrevs->num_code || abbrevs->abbrevs[*code].tag == 0) {
+        return -1;
+    }
+
+    struct dwarf_abbrev *a = &abbrevs->abbrevs[*code];
+
+    memset(die, 0, sizeof(*die));
+    die->tag = a->tag;
+    die->has_children = a->has_children;
+
+    struct dwarf_reader ar;
+    dwarf_reader_init(&ar, fp->debug_abbrev.data, a->spec, fp->debug_abbrev.length);
+
+    while (! ar.err) {
+        uint64_t name = dwarf_read_uleb(&ar);
+        uint64_t form = dwarf_read_uleb(&ar);
+        int64_t implicit_const = 0;
+
+        if (form == DW_FORM_implicit_const) {
+            implicit_const = dwarf_read_sleb(&ar);
+        }
+        if (name == 0 && form == 0) {
+            break;
+        }
+
+        struct dwarf_attr_value v;
+        if (dwarf_read_form(&v, r, fp, up, form, implicit_const) < 0) {
+            return -1;
+        }
+
+        switch (name) {
+        case DW_AT_low_pc:
+            if (form == DW_FORM_addr) {
+                die->low_pc = v.u;
+                die->have_low_pc = 1;
+            }
+            break;
+
+        case DW_AT_high_pc:
+            if (form == DW_FORM_addr) {
+                die->high_pc = v.u;
+                die->have_high_pc = 1;
+            } else if (form == DW_FORM_data1 || form == DW_FORM_data2 ||
+                       form == DW_FORM_data4 || form == DW_FORM_data8 ||
+                       form == DW_FORM_udata || form == DW_FORM_implicit_const)
+            {
+                die->high_pc = v.u;
+                die->have_high_pc = 1;
+                die->high_pc_is_offset = 1;
+            }
+            break;
+
+        case DW_AT_ranges:
+            die->ranges = v.u;
+            die->ranges_form = form;
+            break;
+
+        case DW_AT_abstract_origin:
+        case DW_AT_specification:
+            if (form == DW_FORM_ref_addr) {
+                die->origin = v.u;
+            } else if (form == DW_FORM_ref1 || form == DW_FORM_ref2 ||
+                       form == DW_FORM_ref4 || form == DW_FORM_ref8 ||
+                       form == DW_FORM_ref_udata)
+            {
+                die->origin = unit_offset + v.u;
+            }
+            break;
+
+        case DW_AT_call_file:
+            die->call_file = v.u;
+            break;
+
+        case DW_AT_call_line:
+            die->call_line = v.u;
+            break;
+
+        case DW_AT_rnglists_base:
+            die->rnglists_base = v.u;
+            break;
+
+        case DW_AT_name:
+            die->name = v.str;
+            break;
+
+        case DW_AT_linkage_name:
+        case DW_AT_MIPS_linkage_name:
+            die->linkage_name = v.str;
+            break;
+        }
+    }
+
+    return ar.err ? -1 : 0;
+}
+
+/* name of subprogram at offset of .debug_info. follow abstract origin
+ * and specification. linkage name has priority, to match .symtab */
+static struct npr_symbol *
+resolve_subprogram_name(struct ATR_file *fp,
+                        struct npr_rbtree *name_cache,
+                        uint64_t offset)
+{
+    struct npr_rbtree_node *n = npr_rbtree_find(name_cache, offset);
+    if (n) {
+        return (struct npr_symbol*)n->v;
+    }
+
+    struct npr_symbol *sym = NULL;
+    uint64_t cur = offset;
+
+    for (int follow=0; follow<4 && cur != 0; follow++) {
+        /* unit that contains cur */
+        size_t lo = 0, hi = fp->num_cu;
+        while (lo < hi) {
+            size_t mid = lo + (hi-lo)/2;
+            if (fp->cus[mid].offset <= cur) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo == 0) {
+            break;
+        }
+
+        struct dwarf_unit_param up;
+        uint64_t abbrev_offset, next;
+        struct dwarf_reader r;
+        if (dwarf_read_unit_header(&up, &abbrev_offset, &r, &next, fp, fp->cus[lo-1].offset) != 0 ||
+            cur >= next)
+        {
+            break;
+        }
+
+        struct dwarf_abbrev_table *abbrevs = get_abbrev_table(fp, abbrev_offset);
+        if (abbrevs == NULL) {
+            break;
+        }
+
+        struct dwarf_die die;
+        uint64_t code;
+        r.cur = cur;
+        if (dwarf_read_die(&die, &code, &r, fp, &up, abbrevs, fp->cus[lo-1].offset) < 0 ||
+            code == 0)
+        {
+            break;
+        }
+
+        if (die.linkage_name) {
+            sym = npr_intern(die.linkage_name);
+            break;
+        }
+        if (die.name) {
+            sym = npr_intern(die.name);
+            break;
+        }
+
+        cur = die.origin;
+    }
+
+    npr_rbtree_insert(name_cache, offset, (uintptr_t)sym);
+    return sym;
+}
+
+static void
+push_inline_range(struct npr_varray *ranges,
+                  const struct ATR_inline_range *proto,
+                  uint64_t begin,
+                  uint64_t end)
+{
+    if (begin >= end) {
+        return;
+    }
+
+    struct ATR_inline_range *r;
+    VA_NEWELEM_LASTPTR(struct ATR_inline_range, ranges, r);
+    *r = *proto;
+    r->begin = begin;
+    r->end = end;
+}
+
+/* push ranges of DW_AT_ranges */
+static void
+read_die_ranges(struct npr_varray *ranges,
+                const struct ATR_inline_range *proto,
+                struct ATR_file *fp,
+                const struct dwarf_unit_param *up,
+                const struct dwarf_die *die,
+                uint64_t cu_base,
+                uint64_t rnglists_base)
+{
+    uint64_t base = cu_base;
+    int as = up->address_size;
+    if (as < 1 || as > 8) {
+        return;
+    }
+    uint64_t max_addr = (as == 8) ? (uint64_t)-1 : (((uint64_t)1 << (as*8)) - 1);
+
+    if (up->version < 5) {
+        /* .debug_ranges : (begin, end) pairs */
+        unsigned char *data = ATR_file_section_data(fp, &fp->debug_ranges);
+        if (data == NULL) {
+            return;
+        }
+
+        struct dwarf_reader r;
+        dwarf_reader_init(&r, data, die->ranges, fp->debug_ranges.length);
+
+        while (! r.err) {
+            uint64_t begin = dwarf_read_n(&r, as);
+            uint64_t end = dwarf_read_n(&r, as);
+
+            if (r.err || (begin == 0 && end == 0)) {
+                break;
+            }
+            if (begin == max_addr) {
+                base = end;
+                continue;
+            }
+
+            push_inline_range(ranges, proto, base + begin, base + end);
+        }
+
+        return;
+    }
+
+    /* .debug_rnglists */
+    unsigned char *data = ATR_file_section_data(fp, &fp->debug_rnglists);
+    if (data == NULL) {
+        return;
+    }
+
+    uint64_t offset = die->ranges;
+
+    if (die->ranges_form == DW_FORM_rnglistx) {
+        /* index to offset table at rnglists_base */
+        struct dwarf_reader ir;
+        dwarf_reader_init(&ir, data,
+                          rnglists_base + die->ranges * up->offset_size,
+                          fp->debug_rnglists.length);
+        offset = rnglists_base + dwarf_read_n(&ir, up->offset_size);
+        if (ir.err) {
+            return;
+        }
+    }
+
+    struct dwarf_reader r;
+    dwarf_reader_init(&r, data, offset, fp->debug_rnglists.length);
+
+    while (! r.err) {
+        int kind = dwarf_read_n(&r, 1);
+        uint64_t a, b;
+
+        switch (kind) {
+        case DW_RLE_end_of_list:
+            return;
+
+        case DW_RLE_offset_pair:
+            a = dwarf_read_uleb(&r);
+            b = dwarf_read_uleb(&r);
+            push_inline_range(ranges, proto, base + a, base + b);
+            break;
+
+        case DW_RLE_base_address:
+            base = dwarf_read_n(&r, as);
+            break;
+
+        case DW_RLE_start_end:
+            a = dwarf_read_n(&r, as);
+            b = dwarf_read_n(&r, as);
+            push_inline_range(ranges, proto, a, b);
+            break;
+
+        case DW_RLE_start_length:
+            a = dwarf_read_n(&r, as);
+            b = dwarf_read_uleb(&r);
+            push_inline_range(ranges, proto, a, a + b);
+            break;
+
+        default:
+            /* *x forms need .debug_addr. not supported */
+            return;
+        }
+    }
+}
+
+static int
+cmp_inline_range(const void *a, const void *b)
+{
+    const struct ATR_inline_range *ra = a;
+    const struct ATR_inline_range *rb = b;
+
+    if (ra->begin != rb->begin) {
+        return (ra->begin < rb->begin) ? -1 : 1;
+    }
+    if (ra->depth != rb->depth) {
+        return (ra->depth < rb->depth) ? -1 : 1;
+    }
+    return 0;
+}
+
+#define DWARF_MAX_DIE_DEPTH 256
+
+/* walk DIEs of cu once, and collect DW_TAG_inlined_subroutine ranges */
+static void
+build_inline_table(struct ATR_file *fp,
+                   struct ATR_cu *cu)
+{
+    cu->inlines_decoded = 1;
+
+    struct dwarf_unit_param up;
+    uint64_t abbrev_offset, next;
+    struct dwarf_reader r;
+
+    if (dwarf_read_unit_header(&up, &abbrev_offset, &r, &next, fp, cu->offset) != 0) {
+        return;
+    }
+
+    struct dwarf_abbrev_table *abbrevs = get_abbrev_table(fp, abbrev_offset);
+    if (abbrevs == NULL) {
+        return;
+    }
+
+    /* call_file is index of file table of line program */
+    if (! cu->lines_decoded) {
+        build_line_table(fp, cu);
+    }
+    struct ATR_line_table *lt = cu->lines;
+
+    struct npr_rbtree name_cache;
+    npr_rbtree_init(&name_cache);
+
+    struct npr_varray ranges;
+    npr_varray_init(&ranges, 16, sizeof(struct ATR_inline_range));
+
+    /* inline depth of each DIE level */
+    int inline_depth[DWARF_MAX_DIE_DEPTH];
+    int level = 0;
+    uint64_t cu_base = 0, rnglists_base = 0;
+
+    inline_depth[0] = 0;
+
+    while (r.cur < r.end) {
+        struct dwarf_die die;
+        uint64_t code;
+
+        if (dwarf_read_die(&die, &code, &r, fp, &up, abbrevs, cu->offset) < 0) {
+            break;
+        }
+
+        if (code == 0) {
+            if (level == 0) {
+                break;
+            }
+            level--;
+            continue;
+        }
+
+        int depth = inline_depth[level];
+
+        if (die.tag == DW_TAG_compile_unit || die.tag == DW_TAG_partial_unit) {
+            cu_base = die.have_low_pc ? die.low_pc : 0;
+            rnglists_base = die.rnglists_base;
+        }
+
+        if (die.tag == DW_TAG_inlined_subroutine) {
+            struct ATR_inline_range proto;
+
+            proto.depth = depth;
+            proto.name = die.origin ? resolve_subprogram_name(fp, &name_cache, die.origin) : NULL;
+            proto.call_file = NULL;
+            proto.call_line = die.call_line;
+
+            if (lt && die.call_file < lt->num_file) {
+                proto.call_file = lt->files[die.call_file];
+            }
+
+            if (die.have_low_pc && die.have_high_pc) {
+                uint64_t end = die.high_pc_is_offset ? die.low_pc + die.high_pc : die.high_pc;
+                push_inline_range(&ranges, &proto, die.low_pc, end);
+            } else if (die.ranges_form) {
+                read_die_ranges(&ranges, &proto, fp, &up, &die, cu_base, rnglists_base);
+            }
+
+            depth++;
+        }
+
+        if (die.has_children) {
+            if (level+1 >= DWARF_MAX_DIE_DEPTH) {
+                break;
+            }
+            level++;
+            inline_depth[level] = depth;
+        }
+    }
+
+    npr_rbtree_fini(&name_cache);
+
+    size_t n = ranges.nelem;
+    struct ATR_inline_range *inl = npr_varray_malloc_close(&ranges);
+
+    qsort(inl, n, sizeof(struct ATR_inline_range), cmp_inline_range);
+
+    uintptr_t *max_end = malloc(sizeof(uintptr_t) * (n ? n : 1));
+    for (size_t ii=0; ii<n; ii++) {
+        max_end[ii] = inl[ii].end;
+        if (ii > 0 && max_end[ii-1] > max_end[ii]) {
+            max_end[ii] = max_end[ii-1];
+        }
+    }
+
+    cu->num_inline = n;
+    cu->inlines = inl;
+    cu->inline_max_end = max_end;
+}
+
+static int
+cmp_inline_depth(const void *a, const void *b)
+{
+    const struct ATR_inline_range *ra = *(const struct ATR_inline_range * const *)a;
+    const struct ATR_inline_range *rb = *(const struct ATR_inline_range * const *)b;
+
+    return ra->depth - rb->depth;
+}
+
+static void
+lookup_inline(struct ATR_addr_info *info,
+              struct ATR_file *fp,
+              uintptr_t pc)
+{
+    struct ATR_cu *cu = lookup_cu(fp, pc);
+    if (cu == NULL) {
+        return;
+    }
+
+    if (! cu->inlines_decoded) {
+        build_inline_table(fp, cu);
+    }
+
+    /* find last range that satisfies begin <= pc */
+    size_t lo = 0, hi = cu->num_inline;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi-lo)/2;
+
+        if (cu->inlines[mid].begin <= pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    /* no range before i covers pc once max_end[i] <= pc */
+    for (size_t i=lo; i>0 && cu->inline_max_end[i-1] > pc; i--) {
+        const struct ATR_inline_range *r = &cu->inlines[i-1];
+
+        if (pc < r->end && info->num_inline < ATR_ADDR_INFO_MAX_INLINE) {
+            info->inlines[info->num_inline++] = r;
+        }
+    }
+
+    qsort(info->inlines, info->num_inline,
+          sizeof(info->inlines[0]), cmp_inline_depth);
+}
+
+
+void
+ATR_file_lookup_addr_info(struct ATR_addr_info *info,
+                          struct ATR *atr,
+                          struct ATR_backtracer *tr,
+                          int is_caller)
+{
+    info->flags = 0;
+    info->num_inline = 0;
+
+    struct ATR_file *fp = tr->current_module;
+    uintptr_t pc = tr->pc_offset_in_module-fp->text.start + fp->text.vaddr;
+
+    /* return address may be start of next line (or next function
+     * if call is last instruction of noreturn function). symbol is
+     * looked up at same pc as location, and offset is from pc */
+    uintptr_t loc_pc = (is_caller && pc > 0) ? pc-1 : pc;
+    info->loc_vaddr = loc_pc;
+
+    if (lookup_sym_index(info, atr, fp, loc_pc) == 0) {
+        info->sym_offset += pc - loc_pc;
+    }
+
+    /* separate debug file has same vaddr */
+    struct ATR_file *dfp = dwarf_file(fp);
+    lookup_line(info, dfp, loc_pc);
+    lookup_inline(info, dfp, loc_pc);
+
+    /* 1. .debug_line (location)
+     * 2. .symtab, .dynsym (sym_index)
      */
 
     return;
@@ -9,31 +9,231 @@ extern "C" {
 #endif
 
 struct npr_symbol;
+struct npr_rbtree;
+struct ATR_unwind_memo;
 struct ATR_process;
 struct ATR_backtracer;
+struct stat;
 
 struct ATR_section {
     uintptr_t length;           // 0 if empty
-    uintptr_t start;
+    uintptr_t start;            // offset in file
     uintptr_t vaddr;
     unsigned int entsize;
+
+    /* sections are mapped one by one at first use (ATR_file_section_data) */
+    int advice;                 // madvise() hint of access pattern
+    unsigned char *data;        // start of section. NULL if not mapped
+    void *map_addr;
+    size_t map_length;
+};
+
+/* function symbol of .symtab/.dynsym (ATR_file::sym_index).
+ * has no pointer, so that it can be stored in persistent cache as is */
+struct ATR_sym_index_entry {
+    uintptr_t addr;             // vaddr
+    uintptr_t end;              // next symbol if st_size == 0
+    uintptr_t name;             // see ATR_file::sym_name_base
+};
+
+/* row of decoded .debug_line (ATR_line_table) */
+struct ATR_line_row {
+    uintptr_t addr;             // vaddr
+    uint32_t file;              // index of ATR_line_table::files
+    uint32_t line;              // 0 : end of sequence
+};
+
+/* line program of one CU. sorted by addr */
+struct ATR_line_table {
+    size_t num_row;
+    struct ATR_line_row *rows;
+
+    size_t num_file;
+    struct npr_symbol **files;  // interned path. NULL if unknown
+};
+
+/* one address range of DW_TAG_inlined_subroutine */
+struct ATR_inline_range {
+    uintptr_t begin, end;       // vaddr
+    int depth;                  // 0 : inlined into subprogram directly
+
+    struct npr_symbol *name;    // NULL if unknown
+    struct npr_symbol *call_file; // NULL if unknown
+    int call_line;
+};
+
+/* compilation unit in .debug_info */
+struct ATR_cu {
+    uint64_t offset;            // offset of unit header in .debug_info
+    uint64_t stmt_list;         // offset in .debug_line. (uint64_t)-1 if not found
+    struct npr_symbol *comp_dir; // NULL if not found
+
+    /* decoded at first lookup of pc in this CU.
+     * lines is NULL if CU has no line program */
+    int lines_decoded;
+    struct ATR_line_table *lines;
+
+    /* DW_TAG_inlined_subroutine ranges, sorted by begin.
+     * inline_max_end[i] is max of end of [0, i], so that
+     * ranges that cover a pc are found by walking back from it.
+     * built at first lookup of pc in this CU */
+    int inlines_decoded;
+    size_t num_inline;
+    struct ATR_inline_range *inlines;
+    uintptr_t *inline_max_end;
+};
+
+/* address range covered by ATR_file::cus[cu] */
+struct ATR_cu_range {
+    uintptr_t begin, end;       // vaddr
+    size_t cu;
+};
+
+struct ATR_fde_index_entry {
+    uintptr_t pc_begin;         // vaddr
+    uintptr_t fde_offset;       // offset in .eh_frame
+};
+
+/* compiled unwind rule (like ORC of linux kernel).
+ * only RIP, RSP(=CFA), RBP are recovered by this row. */
+struct ATR_unwind_row {
+    uintptr_t pc_begin;         // vaddr. valid until pc_begin of next row
+    int32_t cfa_offset;
+    int16_t ra_offset;          // from CFA
+    int16_t rbp_offset;         // from CFA, valid if ATR_UNWIND_ROW_RBP_SAVED
+    uint8_t cfa_reg;
+
+#define ATR_UNWIND_ROW_CFA 0    // use this row
+#define ATR_UNWIND_ROW_INTERP 1 // not representable. use CFA interpreter
+#define ATR_UNWIND_ROW_END 2    // not covered by FDE
+    uint8_t type;
+
+#define ATR_UNWIND_ROW_RBP_SAVED (1<<0)
+    uint8_t flags;
 };
 
 struct ATR_file {
     struct npr_symbol *path;
+    struct npr_symbol *build_id; // hex of NT_GNU_BUILD_ID. NULL if not found
     int fd;
 
-    size_t mapped_length;
-    unsigned char *mapped_addr;
+    /* identity of opened file (from fstat) */
+    uint64_t dev, ino;
+    int64_t mtime_sec, mtime_nsec;
+
+    /* module cache (ATR_file_acquire/ATR_file_release) */
+    int refcount;
+    struct ATR_file *cache_chain;
+
+    size_t file_length;
+
+    int unwind_method;          // enum ATR_unwind_method. ATR_UNWIND_DEFAULT if not specified (ATR_set_module_unwind_method)
 
     struct ATR_section text, debug_abbrev, debug_info,
-        eh_frame, symtab, strtab, dynsym, dynstr;
+        eh_frame, eh_frame_hdr, symtab, strtab, dynsym, dynstr,
+        debug_line, debug_line_str, debug_str, debug_aranges,
+        debug_ranges, debug_rnglists;
+
+    /* sorted by addr, one entry per address. built from .symtab and
+     * .dynsym at first lookup */
+    int sym_index_built;
+    size_t num_sym_index;
+    struct ATR_sym_index_entry *sym_index;
+    const char *sym_name_base;  // NULL : name is offset in file (.strtab or .dynstr)
+    struct npr_symbol **sym_index_sym; // interned name. NULL until first lookup
+
+    /* compilation units, and sorted ranges of them. built from
+     * .debug_aranges (or top DIE of each CU) at first lookup */
+    int cu_index_built;
+    size_t num_cu;
+    struct ATR_cu *cus;
+    size_t num_cu_range;
+    struct ATR_cu_range *cu_ranges;
+
+    /* abbrev offset in .debug_abbrev -> decoded table (atr-file.c).
+     * NULL until first use */
+    struct npr_rbtree *abbrev_cache;
+
+    /* separate debug file (.build-id path or .gnu_debuglink), found at open.
+     * symbols and DWARF are read from it if it has them. unwinding always
+     * uses .eh_frame of this file. NULL if not found */
+    struct ATR_file *debug_file;
+
+    /* persistent cache of sym_index and unwind_table (atr-cache.c).
+     * tables found in it point into it */
+    size_t cache_length;
+    unsigned char *cache_addr;  // NULL if not mapped
+
+    /* sorted by pc_begin. built from .eh_frame at first use
+     * if .eh_frame_hdr is not available */
+    int fde_index_built;
+    size_t num_fde_index;
+    struct ATR_fde_index_entry *fde_index;
+
+    /* CIE offset in .eh_frame -> parsed CIE (malloc-ed, see atr-backtrace.c).
+     * NULL until first use */
+    struct npr_rbtree *cie_cache;
+
+    /* set associative LRU cache of resolved unwind rule (see atr-backtrace.c).
+     * NULL until first use */
+    struct ATR_unwind_memo *unwind_memo;
+    size_t unwind_memo_num_set;  // power of 2
+    uint64_t unwind_memo_clock;
+
+    /* sorted by pc_begin. (ATR_file_compile_unwind_table) */
+    int unwind_table_built;
+    size_t num_unwind_row;
+    struct ATR_unwind_row *unwind_table;
 };
 
 /* return negative if failed */
 int ATR_file_open(struct ATR_file *fp, struct ATR *atr, struct npr_symbol *path);
+
+/* same as ATR_file_open, but read from fd. fd is owned by fp (closed if failed).
+ * path is used as name of file */
+int ATR_file_open_fd(struct ATR_file *fp, struct ATR *atr, struct npr_symbol *path, int fd);
 void ATR_file_close(struct ATR *atr, struct ATR_file *fp);
 
+/* open file through module cache of atr.
+ * file is shared while it has same (dev, ino, mtime), or same build id.
+ * return NULL if failed */
+struct ATR_file *ATR_file_acquire(struct ATR *atr, struct npr_symbol *path);
+
+/* same as ATR_file_acquire, but open from fd. fd is closed if it is not used */
+struct ATR_file *ATR_file_acquire_fd(struct ATR *atr, struct npr_symbol *path, int fd);
+
+/* return cached file of path that has same (dev, ino, mtime) as st.
+ * return NULL if not cached */
+struct ATR_file *ATR_file_lookup_cache(struct ATR *atr,
+                                       struct npr_symbol *path,
+                                       const struct stat *st);
+void ATR_file_release(struct ATR *atr, struct ATR_file *fp);
+
+/* map section s of fp if it is not mapped yet.
+ * return NULL if section is empty or couldn't be mapped */
+unsigned char *ATR_file_section_data(struct ATR_file *fp, struct ATR_section *s);
+
+/* build fp->sym_index if it is not built yet, and store it to
+ * persistent cache */
+void ATR_file_build_sym_index(struct ATR *atr, struct ATR_file *fp);
+
+/* name of fp->sym_index[idx]. NULL if string table couldn't be mapped */
+const char *ATR_file_sym_index_name(struct ATR_file *fp, size_t idx);
+
+/* file that has symbol tables of fp (debug_file or fp itself).
+ * names of sym_index are offsets in its string tables */
+struct ATR_file *ATR_file_symbol_file(struct ATR_file *fp);
+
+/* map persistent cache of fp from ATR::cache_dir. tables found in it
+ * are used as built.
+ * return 0 if mapped, negative if not found or invalid */
+int ATR_file_map_cache(struct ATR *atr, struct ATR_file *fp);
+
+/* write sym_index and unwind_table that are built to ATR::cache_dir.
+ * called when a table is built.
+ * failure is ignored (cache is not written) */
+void ATR_file_store_cache(struct ATR *atr, struct ATR_file *fp);
+
 struct ATR_addr_info {
     int flags;                  // 0 if notfound
 #define ATR_ADDR_INFO_HAVE_SYMBOL (1<<0)
@@ -42,14 +242,31 @@ struct ATR_addr_info {
     struct npr_symbol *sym;
     uintptr_t sym_offset;
 
-    struct npr_symbol *source_path;
+    struct npr_symbol *source_path; // valid if HAVE_LOCATION
+    int lineno;                     // valid if HAVE_LOCATION
+    uintptr_t loc_vaddr;            // vaddr in module used to lookup location and inlines
+
+    /* inlined calls at pc, outermost first.
+     * location of inlines[i] is call site of inlines[i+1]
+     * (source_path:lineno for last one), and sym is called at call site of inlines[0] */
+#define ATR_ADDR_INFO_MAX_INLINE 16
+    int num_inline;
+    const struct ATR_inline_range *inlines[ATR_ADDR_INFO_MAX_INLINE];
 };
 
 
+/* is_caller : pc of tr is return address (tr is not top frame).
+ * source location is looked up at pc-1 (call instruction).
+ * info refers to interned symbols and tables of module, and is
+ * valid while module is open */
 void ATR_file_lookup_addr_info(struct ATR_addr_info *info,
                                struct ATR *atr,
-                               struct ATR_backtracer *tr);
+                               struct ATR_backtracer *tr,
+                               int is_caller);
 
+/* release info filled by ATR_file_lookup_addr_info.
+ * nothing is allocated for info now, so this does nothing. kept for
+ * existing callers, call it after use of info */
 void ATR_addr_info_fini(struct ATR *atr,
                         struct ATR_addr_info *info);
 
@@ -10,8 +10,25 @@
 struct ATR_impl {
     int cap_language;           // internal
     struct npr_symtab lang_module_hook_table;
+
+    /* path -> chain of ATR_file (ATR_file_acquire) */
+    struct npr_symtab file_cache;
+
+    /* build id -> ATR_file. files that have same build id share one ATR_file */
+    struct npr_symtab build_id_cache;
+
+    /* build id (or "debuglink:crc") -> result of separate debug file
+     * lookup (atr-file.c). failure is cached too */
+    struct npr_symtab debug_file_cache;
+
+    /* buffer to read /proc files, reused */
+    char *read_buf;
+    size_t read_buf_size;
 };
 
+void ATR_file_cache_init(struct ATR *atr);
+void ATR_file_cache_fini(struct ATR *atr);
+
 void ATR_load_language_module(struct ATR *atr);
 int ATR_run_language_hook(struct ATR *atr,
                           struct ATR_backtracer *tr,
@@ -1,41 +1,535 @@
+#define _GNU_SOURCE
 #include <signal.h>
 #include <dirent.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/user.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/wait.h>
 #include <inttypes.h>
 #include <sys/ptrace.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <limits.h>
 
-#include "npr/strbuf.h"
+#include "npr/mempool.h"
 #include "npr/varray.h"
 #include "npr/symbol.h"
+#include "npr/int-map.h"
 #include "npr/red-black-tree.h"
 
 #include "anytrace/atr.h"
+#include "anytrace/atr-impl.h"
 #include "anytrace/atr-process.h"
 #include "anytrace/atr-file.h"
 #include "anytrace/atr-backtrace.h"
 
+static int
+cmp_mapping(const void *a, const void *b)
+{
+    const struct ATR_mapping *ma = a, *mb = b;
+
+    if (ma->start < mb->start) {
+        return -1;
+    }
+    if (ma->start > mb->start) {
+        return 1;
+    }
+    return 0;
+}
+
+/* read whole file into atr->impl->read_buf.
+ * return length, or -1 if failed */
+static ssize_t
+read_proc_file(struct ATR *atr,
+               const char *path)
+{
+    struct ATR_impl *impl = atr->impl;
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1) {
+        ATR_set_libc_path_error(atr, &atr->last_error, errno, path);
+        return -1;
+    }
+
+    size_t len = 0;
+
+    while (1) {
+        if (impl->read_buf_size - len < 4096) {
+            size_t new_size = impl->read_buf_size * 2;
+            if (new_size < 65536) {
+                new_size = 65536;
+            }
+
+            impl->read_buf = realloc(impl->read_buf, new_size);
+            impl->read_buf_size = new_size;
+        }
+
+        ssize_t rdsz = read(fd, impl->read_buf + len, impl->read_buf_size - len);
+
+        if (rdsz < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            ATR_set_libc_path_error(atr, &atr->last_error, errno, path);
+            close(fd);
+            return -1;
+        }
+
+        if (rdsz == 0) {
+            break;
+        }
+
+        len += rdsz;
+    }
+
+    close(fd);
+
+    return len;
+}
+
+/* parse hex number terminated by 'term'.
+ * return -1 if failed */
+static int
+parse_hex(uint64_t *ret,
+          const char **pp,
+          const char *end,
+          char term)
+{
+    const char *p = *pp;
+    const char *begin = p;
+    uint64_t v = 0;
+
+    while (p < end) {
+        unsigned int c = (unsigned char)*p;
+        unsigned int d;
+
+        if (c - '0' < 10) {
+            d = c - '0';
+        } else if ((c|0x20) - 'a' < 6) {
+            d = (c|0x20) - 'a' + 10;
+        } else {
+            break;
+        }
+
+        v = (v<<4) | d;
+        p++;
+    }
+
+    if (p == begin || p == end || *p != term) {
+        return -1;
+    }
+
+    *ret = v;
+    *pp = p + 1;
+
+    return 0;
+}
+
+void
+ATR_parse_maps(struct ATR_process *dst,
+               const char *buf,
+               size_t length)
+{
+    struct npr_varray modules;
+    npr_varray_init(&modules, 4, sizeof(struct ATR_module));
+
+    struct npr_varray mappings;
+    npr_varray_init(&mappings, 4, sizeof(struct ATR_mapping));
+
+    /* path -> (index of modules)+1 */
+    struct npr_symtab module_index;
+    npr_symtab_init(&module_index, 16);
+
+    const char *p = buf;
+    const char *buf_end = buf + length;
+
+    int sorted = 1;
+    uintptr_t prev_start = 0;
+
+    const char *prev_path = NULL;
+    size_t prev_path_len = 0;
+    int prev_module = 0;
+
+    while (p < buf_end) {
+        /* start-end perm offset dev_major:dev_minor inode path */
+        const char *eol = memchr(p, '\n', buf_end - p);
+        if (eol == NULL) {
+            eol = buf_end;
+        }
+
+        uint64_t start, end, off, devmj, devmn;
+
+        if (parse_hex(&start, &p, eol, '-') < 0 ||
+            parse_hex(&end, &p, eol, ' ') < 0)
+        {
+            break;
+        }
+
+        /* perm */
+        p = memchr(p, ' ', eol - p);
+        if (p == NULL) {
+            break;
+        }
+        p++;
+
+        if (parse_hex(&off, &p, eol, ' ') < 0 ||
+            parse_hex(&devmj, &p, eol, ':') < 0 ||
+            parse_hex(&devmn, &p, eol, ' ') < 0)
+        {
+            break;
+        }
+
+        uint64_t ino = 0;
+        while (p < eol && *p >= '0' && *p <= '9') {
+            ino = ino*10 + (*p - '0');
+            p++;
+        }
+
+        while (p < eol && *p == ' ') {
+            p++;
+        }
+
+        if (p == eol) {
+            /* anonymous */
+            p = eol + 1;
+            continue;
+        }
+
+        size_t path_len = eol - p;
+        int mi;
+
+        if (prev_path &&
+            prev_path_len == path_len &&
+            memcmp(prev_path, p, path_len) == 0)
+        {
+            /* segments of module are listed successively */
+            mi = prev_module;
+            goto add_mapping;
+        }
+
+        struct npr_symbol *module_path = npr_intern_with_length(p, path_len);
+        struct npr_symtab_entry *e = npr_symtab_lookup_entry(&module_index,
+                                                             module_path,
+                                                             NPR_LOOKUP_APPEND);
+
+        if (e->data == NULL) {
+            struct ATR_module *m;
+
+            mi = modules.nelem;
+            VA_NEWELEM_LASTPTR(struct ATR_module, &modules, m);
+
+            m->path = module_path;
+            m->file = NULL;
+            m->dev = makedev(devmj, devmn);
+            m->ino = ino;
+            m->first_mapping = -1;
+
+            e->data = (void*)(intptr_t)(mi+1);
+        } else {
+            mi = (int)(intptr_t)e->data - 1;
+        }
+
+        prev_path = p;
+        prev_path_len = path_len;
+        prev_module = mi;
+
+    add_mapping:;
+        struct ATR_mapping *ma;
+        VA_NEWELEM_LASTPTR(struct ATR_mapping, &mappings, ma);
+
+        ma->start = start;
+        ma->end = end;
+        ma->offset = off;
+        ma->module = mi;
+
+        if (start < prev_start) {
+            sorted = 0;
+        }
+        prev_start = start;
+
+        p = eol + 1;
+    }
+
+    npr_symtab_fini(&module_index);
+
+    dst->num_mapping = mappings.nelem;
+    dst->mappings = npr_varray_malloc_close(&mappings);
+    dst->last_found_mapping = 0;
+
+    /* kernel lists mappings in address order, but ATR_find_mapping
+     * depends on it */
+    if (! sorted) {
+        qsort(dst->mappings, dst->num_mapping, sizeof(struct ATR_mapping), cmp_mapping);
+    }
+
+    dst->num_module = modules.nelem;
+    dst->modules = npr_varray_malloc_close(&modules);
+
+    for (int mi=dst->num_mapping-1; mi>=0; mi--) {
+        dst->modules[dst->mappings[mi].module].first_mapping = mi;
+    }
+}
+
+/* PTRACE_EVENT_STOP of group-stop reports stop signal.
+ * (PTRACE_INTERRUPT, and end of group-stop report SIGTRAP) */
+static int
+is_group_stop(int wait_st)
+{
+    int sig = WSTOPSIG(wait_st);
+
+    return (wait_st >> 16) == PTRACE_EVENT_STOP &&
+        (sig == SIGSTOP || sig == SIGTSTP || sig == SIGTTIN || sig == SIGTTOU);
+}
+
+/* tid -> 1 if task is in group-stop */
+static void
+set_group_stopped(struct ATR_process *proc,
+                  int tid,
+                  int group_stopped)
+{
+    if (proc->group_stopped == NULL) {
+        if (! group_stopped) {
+            return;
+        }
+
+        proc->group_stopped = malloc(sizeof(struct npr_rbtree));
+        npr_rbtree_init(proc->group_stopped);
+    }
+
+    struct npr_rbtree_node *n = npr_rbtree_find(proc->group_stopped, tid);
+    if (n) {
+        n->v = group_stopped;
+    } else if (group_stopped) {
+        npr_rbtree_insert(proc->group_stopped, tid, 1);
+    }
+}
+
+static int
+is_group_stopped(struct ATR_process *proc,
+                 int tid)
+{
+    if (proc->group_stopped == NULL) {
+        return 0;
+    }
+
+    struct npr_rbtree_node *n = npr_rbtree_find(proc->group_stopped, tid);
+    return n && n->v;
+}
+
+/* restart task from stop that is not requested by us, as if it
+ * were not traced.
+ *   signal-delivery-stop : deliver the signal
+ *   group-stop : PTRACE_LISTEN. task stays stopped until SIGCONT
+ *   end of group-stop, other events : PTRACE_CONT */
+static void
+restart_task(struct ATR_process *proc,
+             int tid,
+             int wait_st)
+{
+    int event = wait_st >> 16;
+
+    if (event == PTRACE_EVENT_STOP) {
+        if (is_group_stop(wait_st)) {
+            set_group_stopped(proc, tid, 1);
+            ptrace(PTRACE_LISTEN, tid, NULL, NULL);
+        } else {
+            set_group_stopped(proc, tid, 0);
+            ptrace(PTRACE_CONT, tid, NULL, NULL);
+        }
+    } else if (event) {
+        ptrace(PTRACE_CONT, tid, NULL, NULL);
+    } else {
+        ptrace(PTRACE_CONT, tid, NULL, (void*)(intptr_t)WSTOPSIG(wait_st));
+    }
+}
+
+/* add tid to proc->tasks if it is not listed */
+static void
+add_task(struct ATR_process *proc,
+         int tid)
+{
+    for (int ti=0; ti<proc->num_task; ti++) {
+        if (proc->tasks[ti] == tid) {
+            return;
+        }
+    }
+
+    proc->tasks = realloc(proc->tasks, sizeof(int) * (proc->num_task + 1));
+    proc->tasks[proc->num_task++] = tid;
+}
+
+/* thread created by tid, that reported PTRACE_EVENT_CLONE. it is
+ * attached automatically (PTRACE_O_TRACECLONE), and starts in
+ * PTRACE_EVENT_STOP. pushed to new_tasks, or added to proc->tasks if
+ * new_tasks is NULL */
+static void
+add_clone(struct ATR_process *proc,
+          int tid,
+          struct npr_varray *new_tasks)
+{
+    unsigned long child;
+
+    if (ptrace(PTRACE_GETEVENTMSG, tid, NULL, &child) != 0) {
+        return;
+    }
+
+    if (new_tasks) {
+        VA_PUSH(int, new_tasks, (int)child);
+    } else {
+        add_task(proc, (int)child);
+    }
+}
+
+/* wait for stop by PTRACE_INTERRUPT.
+ * task in group-stop reports it instead, and is marked in
+ * proc->group_stopped, so that ATR_resume_task keeps it stopped.
+ * threads created while waiting are recorded by add_clone.
+ * return -1 if failed (errno is set) */
+static int
+wait_interrupt_stop(struct ATR_process *proc,
+                    int tid,
+                    struct npr_varray *new_tasks)
+{
+    while (1) {
+        int wait_st;
+        int r = waitpid(tid, &wait_st, __WALL);
+
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        if (WIFEXITED(wait_st) || WIFSIGNALED(wait_st)) {
+            errno = ESRCH;
+            return -1;
+        }
+
+        if (WIFSTOPPED(wait_st)) {
+            int event = wait_st >> 16;
+
+            if (event == PTRACE_EVENT_STOP) {
+                /* registers can be read in both */
+                set_group_stopped(proc, tid, is_group_stop(wait_st));
+                return 0;
+            }
+
+            if (event == PTRACE_EVENT_CLONE) {
+                add_clone(proc, tid, new_tasks);
+            }
+
+            /* signal-delivery-stop arrived before interrupt.
+             * deliver it, and wait for stop by interrupt */
+            restart_task(proc, tid, wait_st);
+        }
+    }
+}
+
 int
-ATR_open_process(struct ATR_process *dst,
-                 struct ATR *atr,
-                 int pid)
+ATR_stop_task(struct ATR *atr,
+              struct ATR_process *proc,
+              int tid)
 {
-    if (pid < 0) {
-        ATR_set_invalid_argument(atr,
-                                 &atr->last_error,
-                                 __FILE__,
-                                 __func__,
-                                 __LINE__);
+    if (! proc->seized) {
+        /* stopped while attached */
+        return 0;
+    }
+
+    if (ptrace(PTRACE_INTERRUPT, tid, NULL, NULL) != 0) {
+        ATR_set_libc_path_error(atr, &atr->last_error, errno, "ptrace");
         return -1;
     }
 
+    if (wait_interrupt_stop(proc, tid, NULL) < 0) {
+        ATR_set_libc_path_error(atr, &atr->last_error, errno, "waitpid");
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+ATR_resume_task(struct ATR *atr,
+                struct ATR_process *proc,
+                int tid)
+{
+    if (! proc->seized) {
+        return;
+    }
+
+    if (is_group_stopped(proc, tid)) {
+        /* keep job control stop */
+        ptrace(PTRACE_LISTEN, tid, NULL, NULL);
+    } else {
+        ptrace(PTRACE_CONT, tid, NULL, NULL);
+    }
+}
+
+void
+ATR_poll_process(struct ATR *atr,
+                 struct ATR_process *proc)
+{
+    if (! proc->seized) {
+        return;
+    }
+
+    for (int ti=0; ti<proc->num_task; ti++) {
+        int tid = proc->tasks[ti];
+        int wait_st;
+
+        while (1) {
+            int r = waitpid(tid, &wait_st, WNOHANG|__WALL);
+            if (r < 0 && errno == EINTR) {
+                continue;
+            }
+            if (r <= 0 || ! WIFSTOPPED(wait_st)) {
+                break;
+            }
+
+            /* new thread is polled in this loop, and restarted from
+             * its first stop */
+            if ((wait_st >> 16) == PTRACE_EVENT_CLONE) {
+                add_clone(proc, tid, NULL);
+            }
+
+            restart_task(proc, tid, wait_st);
+        }
+    }
+}
 
-    char buf[1024];
+/* threads created meanwhile are recorded by add_clone, to be
+ * detached too */
+static void
+detach_task(struct ATR_process *proc,
+            int tid,
+            struct npr_varray *new_tasks)
+{
+    if (proc->seized) {
+        /* PTRACE_DETACH requires stopped tracee */
+        if (ptrace(PTRACE_INTERRUPT, tid, NULL, NULL) != 0 ||
+            wait_interrupt_stop(proc, tid, new_tasks) < 0)
+        {
+            return;
+        }
+    }
+
+    ptrace(PTRACE_DETACH, tid, NULL, NULL);
+}
+
+/* push tids in /proc/pid/task to tids.
+ * return -1 if failed */
+static int
+list_tasks(struct ATR *atr,
+           int pid,
+           struct npr_varray *tids)
+{
+    char buf[64];
     sprintf(buf, "/proc/%d/task", pid);
     DIR *tasks = opendir(buf);
     if (tasks == NULL) {
@@ -43,12 +537,6 @@ ATR_open_process(struct ATR_process *dst,
         return -1;
     }
 
-    dst->allocator = (struct npr_mempool*)malloc(sizeof(struct npr_mempool));
-    npr_mempool_init(dst->allocator, 128);
-
-    struct npr_varray tid_list;
-    npr_varray_init(&tid_list, 4, sizeof(int));
-
     while (1) {
         struct dirent entry, *result;
         int r = readdir_r(tasks, &entry, &result);
@@ -62,135 +550,240 @@ ATR_open_process(struct ATR_process *dst,
         }
 
         int tid = atoi(result->d_name);
-        VA_PUSH(int, &tid_list, tid);
+        VA_PUSH(int, tids, tid);
     }
 
+    return 0;
+}
 
-    dst->num_task = tid_list.nelem;
-    dst->tasks = (int*)npr_varray_close(&tid_list, dst->allocator);
-
-    for (int ti=0; ti<dst->num_task; ti++) {
-        int tid = dst->tasks[ti];
-        long pt_result = ptrace(PTRACE_ATTACH, tid, NULL, NULL);
-        if (pt_result != 0) {
-            if (errno == EPERM) {
-                FILE *yama = fopen("/proc/sys/kernel/yama/ptrace_scope", "rb");
-                int c = fgetc(yama);
-                fclose(yama);
-
-                if (c != '0') {
-                    ATR_set_error_code(atr, &atr->last_error, ATR_YAMA_ENABLED);
-                    return -1;
-                }
-            }
+static void
+set_attach_error(struct ATR *atr,
+                 int err)
+{
+    if (err == EPERM) {
+        FILE *yama = fopen("/proc/sys/kernel/yama/ptrace_scope", "rb");
+        int c = '0';
 
-            ATR_set_libc_path_error(atr,
-                                    &atr->last_error,
-                                    errno,
-                                    "ptrace");
-            return -1;
+        if (yama) {
+            c = fgetc(yama);
+            fclose(yama);
+        }
+
+        if (c != '0') {
+            ATR_set_error_code(atr, &atr->last_error, ATR_YAMA_ENABLED);
+            return;
         }
-        int wait_st;
-        waitpid(tid, &wait_st, 0);
     }
 
-    sprintf(buf, "/proc/%d/maps", pid);
-    FILE *fp = fopen(buf, "rb");
+    ATR_set_libc_path_error(atr, &atr->last_error, err, "ptrace");
+}
 
-    if (fp == NULL) {
-        ATR_set_libc_path_error(atr, &atr->last_error, errno, buf);
-        npr_mempool_fini(dst->allocator);
-        free(dst->allocator);
+/* thread cloned by seized task is traced already (PTRACE_O_TRACECLONE),
+ * and can be listed before its creator reports it. it is ours if it can
+ * be waited. its first stop is restarted if it has arrived.
+ * return 1 if tid is traced by us */
+static int
+is_auto_attached(struct ATR_process *proc,
+                 int tid)
+{
+    int wait_st;
+    int r = waitpid(tid, &wait_st, WNOHANG|__WALL);
 
-        for (int ti=0; ti<dst->num_task; ti++) {
-            int tid = dst->tasks[ti];
-            ptrace(PTRACE_DETACH, tid, NULL, NULL);
-        }
+    if (r < 0) {
+        return 0;
+    }
 
-        return -1;
+    if (r > 0 && WIFSTOPPED(wait_st)) {
+        restart_task(proc, tid, wait_st);
     }
 
-    struct npr_strbuf path_buf;
-    npr_strbuf_init(&path_buf);
+    return 1;
+}
 
-    struct npr_varray modules;
-    npr_varray_init(&modules, 4, sizeof(struct ATR_module));
+/* attach to all tasks of pid.
+ * /proc/pid/task is listed until no new task is found, and
+ * exited tasks are dropped.
+ * return -1 if failed (attached tasks are detached) */
+static int
+attach_tasks(struct ATR_process *dst,
+             struct ATR *atr,
+             int pid,
+             struct npr_varray *attached)
+{
+    struct npr_rbtree attached_set;
+    struct npr_varray listed, to_stop, new_tasks;
+    int ret = -1;
 
-    struct npr_varray mappings;
-    npr_varray_init(&mappings, 4, sizeof(struct ATR_mapping));
+    npr_rbtree_init(&attached_set);
+    npr_varray_init(&listed, 16, sizeof(int));
+    npr_varray_init(&to_stop, 16, sizeof(int));
+    npr_varray_init(&new_tasks, 4, sizeof(int));
+
+    /* seized process runs while it is attached. its threads are
+     * traced from clone, and stop there until next ATR call */
+    long options = PTRACE_O_TRACECLONE;
 
     while (1) {
-    next_line:;
-        char perm[5];
-        long long start, end, off, ino;
-        int devmj, devmn;
-        int r =fscanf(fp, "%llx-%llx %s %llx %d:%d %lld",
-                      &start, &end, perm, &off, &devmj, &devmn, &ino);
-
-        if (r != 7) {
-            break;
+        int num_new = 0;
+
+        listed.nelem = 0;
+        if (list_tasks(atr, pid, &listed) < 0) {
+            goto fini;
         }
 
-        while (1) {
-            int c = fgetc(fp);
-            if (c != ' ') {
-                if (c == '\n') {
-                    goto next_line;
-                } else {
-                    npr_strbuf_putc(&path_buf, c);
+        to_stop.nelem = 0;
+
+        for (int ti=0; ti<listed.nelem; ti++) {
+            int tid = VA_ELEM(int, &listed, ti);
+
+            if (npr_rbtree_has_key(&attached_set, tid)) {
+                continue;
+            }
+
+            if (ptrace(PTRACE_SEIZE, tid, NULL, (void*)options) != 0) {
+                if (errno == ESRCH) {
+                    /* exited */
+                    continue;
                 }
-                break;
+
+                if (errno == EPERM && dst->seized && is_auto_attached(dst, tid)) {
+                    npr_rbtree_insert(&attached_set, tid, 1);
+                    VA_PUSH(int, attached, tid);
+                    num_new++;
+                    continue;
+                }
+
+                set_attach_error(atr, errno);
+                goto fini;
             }
+
+            npr_rbtree_insert(&attached_set, tid, 1);
+            VA_PUSH(int, attached, tid);
+            VA_PUSH(int, &to_stop, tid);
+            num_new++;
         }
 
-        while (1) {
-            int c = fgetc(fp);
-            if (c == '\n') {
-                break;
-            }
+        if (num_new == 0) {
+            break;
+        }
 
-            npr_strbuf_putc(&path_buf, c);
+        if (dst->seized) {
+            continue;
         }
 
+        /* stop new tasks. interrupt all of them, then wait */
+        for (int ti=0; ti<to_stop.nelem; ti++) {
+            ptrace(PTRACE_INTERRUPT, VA_ELEM(int, &to_stop, ti), NULL, NULL);
+        }
 
-        struct ATR_module *m;
-        char *module_path = npr_strbuf_c_str(&path_buf);
-        int mi;
+        for (int ti=0; ti<to_stop.nelem; ti++) {
+            int tid = VA_ELEM(int, &to_stop, ti);
 
-        for (mi=0; mi<modules.nelem; mi++) {
-            m = VA_ELEM_PTR(struct ATR_module, &modules, mi);
-            if (strcmp(m->path->symstr, module_path) == 0) {
-                break;
+            new_tasks.nelem = 0;
+
+            if (wait_interrupt_stop(dst, tid, &new_tasks) < 0) {
+                /* exited while attaching */
+                for (int ai=0; ai<attached->nelem; ai++) {
+                    if (VA_ELEM(int, attached, ai) == tid) {
+                        VA_ELEM(int, attached, ai) = -1;
+                    }
+                }
+                continue;
+            }
+
+            /* threads created before stop. they are already
+             * attached, and stop by PTRACE_EVENT_STOP */
+            for (int ni=0; ni<new_tasks.nelem; ni++) {
+                int child = VA_ELEM(int, &new_tasks, ni);
+
+                if (! npr_rbtree_has_key(&attached_set, child)) {
+                    npr_rbtree_insert(&attached_set, child, 1);
+                    VA_PUSH(int, attached, child);
+                    VA_PUSH(int, &to_stop, child);
+                }
             }
         }
+    }
 
-        if (mi == modules.nelem) {
-            VA_NEWELEM_LASTPTR(struct ATR_module, &modules, m);
+    /* drop exited tasks */
+    int num_alive = 0;
+    for (int ai=0; ai<attached->nelem; ai++) {
+        int tid = VA_ELEM(int, attached, ai);
+        if (tid != -1) {
+            VA_ELEM(int, attached, num_alive++) = tid;
+        }
+    }
+    attached->nelem = num_alive;
 
-            m->path = npr_intern(npr_strbuf_c_str(&path_buf));
+    ret = 0;
+
+fini:
+    if (ret < 0) {
+        for (int ai=0; ai<attached->nelem; ai++) {
+            int tid = VA_ELEM(int, attached, ai);
+            if (tid != -1) {
+                detach_task(dst, tid, attached);
+            }
         }
+    }
 
-        struct ATR_mapping *ma;
-        VA_NEWELEM_LASTPTR(struct ATR_mapping, &mappings, ma);
+    npr_rbtree_fini(&attached_set);
+    npr_varray_discard(&listed);
+    npr_varray_discard(&to_stop);
+    npr_varray_discard(&new_tasks);
 
-        ma->start = start;
-        ma->end = end;
-        ma->offset = off;
-        ma->module = mi;
+    return ret;
+}
 
-        path_buf.cur = 0;
+int
+ATR_open_process(struct ATR_process *dst,
+                 struct ATR *atr,
+                 int pid)
+{
+    if (pid < 0) {
+        ATR_set_invalid_argument(atr,
+                                 &atr->last_error,
+                                 __FILE__,
+                                 __func__,
+                                 __LINE__);
+        return -1;
     }
 
-    fclose(fp);
-    npr_strbuf_fini(&path_buf);
+    struct npr_varray tid_list;
+    npr_varray_init(&tid_list, 4, sizeof(int));
 
-    dst->pid = pid;
+    dst->seized = (atr->flags & ATR_ATTACH_SEIZE) != 0;
+    dst->group_stopped = NULL;
 
-    dst->num_mapping = mappings.nelem;
-    dst->mappings = npr_varray_close(&mappings, dst->allocator);
+    if (attach_tasks(dst, atr, pid, &tid_list) < 0) {
+        npr_varray_discard(&tid_list);
+        return -1;
+    }
 
-    dst->num_module = modules.nelem;
-    dst->modules = npr_varray_close(&modules, dst->allocator);
+    char buf[64];
+    sprintf(buf, "/proc/%d/maps", pid);
+    ssize_t maps_len = read_proc_file(atr, buf);
+
+    if (maps_len < 0) {
+        for (int ti=0; ti<tid_list.nelem; ti++) {
+            detach_task(dst, VA_ELEM(int, &tid_list, ti), &tid_list);
+        }
+
+        npr_varray_discard(&tid_list);
+        return -1;
+    }
+
+    dst->allocator = (struct npr_mempool*)malloc(sizeof(struct npr_mempool));
+    npr_mempool_init(dst->allocator, 128);
+
+    dst->num_task = tid_list.nelem;
+    dst->tasks = npr_varray_malloc_close(&tid_list);
+
+    dst->pid = pid;
+    dst->no_vm_readv = 0;
+    dst->mem_fd = -1;
+
+    ATR_parse_maps(dst, atr->impl->read_buf, maps_len);
 
     return 0;
 }
@@ -200,8 +793,26 @@ ATR_close_process(struct ATR *atr,
                   struct ATR_process *proc)
 {
     for (int ti=0; ti<proc->num_task; ti++) {
-        int tid = proc->tasks[ti];
-        ptrace(PTRACE_DETACH, tid, NULL, NULL);
+        detach_task(proc, proc->tasks[ti], NULL);
+    }
+
+    if (proc->mem_fd != -1) {
+        close(proc->mem_fd);
+    }
+
+    for (int mi=0; mi<proc->num_module; mi++) {
+        if (proc->modules[mi].file) {
+            ATR_file_release(atr, proc->modules[mi].file);
+        }
+    }
+
+    free(proc->tasks);
+    free(proc->modules);
+    free(proc->mappings);
+
+    if (proc->group_stopped) {
+        npr_rbtree_fini(proc->group_stopped);
+        free(proc->group_stopped);
     }
 
     npr_mempool_fini(proc->allocator);
@@ -209,32 +820,403 @@ ATR_close_process(struct ATR *atr,
 }
 
 
+/* name of file of module as target sees it, in order of preference
+ * (0 <= step < 3). buf has PATH_MAX+64 bytes.
+ * return NULL if there is no name for step */
+static const char *
+module_file_name(char *buf,
+                 struct ATR_process *proc,
+                 int module,
+                 int step)
+{
+    struct ATR_module *m = &proc->modules[module];
+    const char *path = m->path->symstr;
+
+    switch (step) {
+    case 0: {
+        /* map_files works for deleted file, and for file in
+         * other mount namespace */
+        if (m->first_mapping < 0) {
+            return NULL;
+        }
+
+        struct ATR_mapping *map = &proc->mappings[m->first_mapping];
+        sprintf(buf, "/proc/%d/map_files/%" PRIxPTR "-%" PRIxPTR,
+                proc->pid, map->start, map->end);
+        return buf;
+    }
+
+    case 1: {
+        /* path from root of target (container) */
+        size_t path_len = strlen(path);
+        static const char deleted[] = " (deleted)";
+        size_t deleted_len = sizeof(deleted) - 1;
+
+        if (path_len > deleted_len &&
+            strcmp(path + path_len - deleted_len, deleted) == 0)
+        {
+            path_len -= deleted_len;
+        }
+
+        if (path[0] != '/' || path_len >= PATH_MAX) {
+            return NULL;
+        }
+
+        sprintf(buf, "/proc/%d/root%.*s", proc->pid, (int)path_len, path);
+        return buf;
+    }
+
+    default:
+        /* path in our namespace */
+        return path;
+    }
+}
+
+/* open file of module as target sees it.
+ * return -1 if failed */
+static int
+open_module_file(struct ATR *atr,
+                 struct ATR_process *proc,
+                 int module)
+{
+    char buf[PATH_MAX + 64];
+    const char *name = NULL;
+
+    for (int step=0; step<3; step++) {
+        name = module_file_name(buf, proc, module, step);
+        if (name) {
+            int fd = open(name, O_RDONLY);
+            if (fd != -1) {
+                return fd;
+            }
+        }
+    }
+
+    ATR_set_libc_path_error(atr, &atr->last_error, errno, name);
+    return -1;
+}
+
+/* stat file of module as target sees it, without opening it.
+ * return -1 if failed */
+static int
+stat_module_file(struct stat *st,
+                 struct ATR_process *proc,
+                 int module)
+{
+    char buf[PATH_MAX + 64];
+
+    for (int step=0; step<3; step++) {
+        const char *name = module_file_name(buf, proc, module, step);
+        if (name && stat(name, st) == 0) {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+int
+ATR_refresh_process(struct ATR *atr,
+                    struct ATR_process *proc)
+{
+    char buf[64];
+    sprintf(buf, "/proc/%d/maps", proc->pid);
+    ssize_t maps_len = read_proc_file(atr, buf);
+
+    if (maps_len < 0) {
+        return -1;
+    }
+
+    int num_old_module = proc->num_module;
+    struct ATR_module *old_modules = proc->modules;
+    struct ATR_mapping *old_mappings = proc->mappings;
+
+    ATR_parse_maps(proc, atr->impl->read_buf, maps_len);
+
+    /* path -> (index of old_modules)+1 */
+    struct npr_symtab old_index;
+    npr_symtab_init(&old_index, 16);
+
+    for (int mi=0; mi<num_old_module; mi++) {
+        struct npr_symtab_entry *e = npr_symtab_lookup_entry(&old_index,
+                                                             old_modules[mi].path,
+                                                             NPR_LOOKUP_APPEND);
+        e->data = (void*)(intptr_t)(mi+1);
+    }
+
+    /* take over opened files (and their caches) of unchanged modules */
+    for (int mi=0; mi<proc->num_module; mi++) {
+        struct ATR_module *m = &proc->modules[mi];
+        struct npr_symtab_entry *e = npr_symtab_lookup_entry(&old_index,
+                                                             m->path,
+                                                             NPR_LOOKUP_FAIL);
+        if (e == NULL) {
+            continue;
+        }
+
+        struct ATR_module *old = &old_modules[(intptr_t)e->data - 1];
+
+        if (old->dev != m->dev || old->ino != m->ino || old->file == NULL) {
+            continue;
+        }
+
+        /* file rewritten in place keeps (dev, ino) */
+        struct stat st;
+        if (stat_module_file(&st, proc, mi) == 0 &&
+            old->file->mtime_sec == st.st_mtim.tv_sec &&
+            old->file->mtime_nsec == st.st_mtim.tv_nsec)
+        {
+            m->file = old->file;
+            old->file = NULL;
+        }
+    }
+
+    npr_symtab_fini(&old_index);
+
+    /* unmapped or replaced */
+    for (int mi=0; mi<num_old_module; mi++) {
+        if (old_modules[mi].file) {
+            ATR_file_release(atr, old_modules[mi].file);
+        }
+    }
+
+    free(old_modules);
+    free(old_mappings);
+
+    return 0;
+}
+
+struct ATR_mapping *
+ATR_find_mapping(struct ATR_process *proc,
+                 uintptr_t addr)
+{
+    int nm = proc->num_mapping;
+
+    if (nm == 0) {
+        return NULL;
+    }
+
+    /* consecutive lookups often hit same mapping */
+    struct ATR_mapping *map = &proc->mappings[proc->last_found_mapping];
+    if (addr >= map->start && addr < map->end) {
+        return map;
+    }
+
+    /* find last mapping that satisfies start <= addr */
+    int lo = 0, hi = nm;
+
+    while (lo < hi) {
+        int mid = lo + (hi-lo)/2;
+
+        if (proc->mappings[mid].start <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0) {
+        return NULL;
+    }
+
+    map = &proc->mappings[lo-1];
+
+    if (addr >= map->end) {
+        return NULL;
+    }
+
+    proc->last_found_mapping = lo-1;
+
+    return map;
+}
+
 int
 ATR_lookup_map_info(struct ATR_map_info *info,
                     struct ATR *atr,
                     struct ATR_process *proc,
                     uintptr_t addr)
 {
-    int nm = proc->num_mapping;
-    for (int mi=0; mi<nm; mi++) {
-        struct ATR_mapping *map = &proc->mappings[mi];
+    struct ATR_mapping *map = ATR_find_mapping(proc, addr);
 
-        if (addr >= map->start &&
-            addr < map->end)
-        {
-            /* found */
+    if (map == NULL) {
+        return -1;
+    }
 
-            struct ATR_module *m = &proc->modules[map->module];
+    struct ATR_module *m = &proc->modules[map->module];
 
-            info->path = m->path;
+    info->path = m->path;
+    info->module = map->module;
 
-            uintptr_t map_offset = addr - map->start;
-            info->offset = map_offset + map->offset;
+    uintptr_t map_offset = addr - map->start;
+    info->offset = map_offset + map->offset;
 
-            return 0;
+    return 0;
+}
+
+static int
+read_memory_pread(struct ATR *atr,
+                  struct ATR_process *proc,
+                  struct ATR_mem_read *reads,
+                  int num_read)
+{
+    if (proc->mem_fd == -1) {
+        char path[64];
+        sprintf(path, "/proc/%d/mem", proc->pid);
+        proc->mem_fd = open(path, O_RDONLY);
+
+        if (proc->mem_fd == -1) {
+            ATR_set_libc_path_error(atr, &atr->last_error, errno, path);
+            return -1;
+        }
+    }
+
+    for (int ri=0; ri<num_read; ri++) {
+        ssize_t rdsz = pread(proc->mem_fd, reads[ri].dst, reads[ri].length,
+                             (off_t)reads[ri].addr);
+
+        if (rdsz != (ssize_t)reads[ri].length) {
+            ATR_set_read_frame_failed(atr, &atr->last_error,
+                                      reads[ri].addr,
+                                      rdsz < 0 ? errno : EFAULT);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+#define MAX_GATHER_READ 32
+
+int
+ATR_read_memory_gather(struct ATR *atr,
+                       struct ATR_process *proc,
+                       struct ATR_mem_read *reads,
+                       int num_read)
+{
+    while (num_read > 0 && !proc->no_vm_readv) {
+        struct iovec local[MAX_GATHER_READ], remote[MAX_GATHER_READ];
+        int n = num_read;
+        size_t total = 0;
+
+        if (n > MAX_GATHER_READ) {
+            n = MAX_GATHER_READ;
+        }
+
+        for (int ri=0; ri<n; ri++) {
+            local[ri].iov_base = reads[ri].dst;
+            local[ri].iov_len = reads[ri].length;
+            remote[ri].iov_base = (void*)reads[ri].addr;
+            remote[ri].iov_len = reads[ri].length;
+            total += reads[ri].length;
+        }
+
+        ssize_t rdsz = process_vm_readv(proc->pid, local, n, remote, n, 0);
+
+        if (rdsz < 0 && (errno == ENOSYS || errno == EPERM)) {
+            proc->no_vm_readv = 1;
+            break;
+        }
+
+        if (rdsz != (ssize_t)total) {
+            /* find first failed entry */
+            size_t done = rdsz < 0 ? 0 : rdsz;
+            int ri;
+
+            for (ri=0; ri<n-1; ri++) {
+                if (done < reads[ri].length) {
+                    break;
+                }
+                done -= reads[ri].length;
+            }
+
+            ATR_set_read_frame_failed(atr, &atr->last_error,
+                                      reads[ri].addr + done,
+                                      rdsz < 0 ? errno : EFAULT);
+            return -1;
         }
+
+        reads += n;
+        num_read -= n;
+    }
+
+    if (num_read > 0) {
+        return read_memory_pread(atr, proc, reads, num_read);
     }
 
+    return 0;
+}
+
+int
+ATR_read_memory(struct ATR *atr,
+                struct ATR_process *proc,
+                void *dst,
+                uintptr_t addr,
+                size_t length)
+{
+    struct ATR_mem_read r;
+
+    r.addr = addr;
+    r.length = length;
+    r.dst = dst;
+
+    return ATR_read_memory_gather(atr, proc, &r, 1);
+}
+
+struct ATR_file *
+ATR_process_module_file(struct ATR *atr,
+                        struct ATR_process *proc,
+                        int module)
+{
+    struct ATR_module *m = &proc->modules[module];
+
+    if (m->file) {
+        return m->file;
+    }
+
+    /* (dev, ino) in maps can't tell a file rewritten in place, so
+     * file opened by another process is looked up with mtime from
+     * stat. opening is needed only if it is not cached */
+    struct stat st;
+    if (stat_module_file(&st, proc, module) == 0) {
+        m->file = ATR_file_lookup_cache(atr, m->path, &st);
+        if (m->file) {
+            return m->file;
+        }
+    }
+
+    int fd = open_module_file(atr, proc, module);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    m->file = ATR_file_acquire_fd(atr, m->path, fd);
+
+    return m->file;
+}
+
+int
+ATR_set_module_unwind_method(struct ATR *atr,
+                             struct ATR_process *proc,
+                             const char *path,
+                             enum ATR_unwind_method method)
+{
+    struct npr_symbol *sym = npr_intern(path);
+
+    for (int mi=0; mi<proc->num_module; mi++) {
+        if (proc->modules[mi].path != sym) {
+            continue;
+        }
+
+        struct ATR_file *fp = ATR_process_module_file(atr, proc, mi);
+        if (fp == NULL) {
+            return -1;
+        }
+
+        fp->unwind_method = method;
+        return 0;
+    }
+
+    ATR_set_error_code(atr, &atr->last_error, ATR_MAP_NOT_FOUND);
     return -1;
 }
 
@@ -260,36 +1242,43 @@ ATR_dump_process(FILE *fp,
 
     for (int ti=0; ti<proc->num_task; ti++) {
         int tid = proc->tasks[ti];
-        struct user_regs_struct regs;
-        ptrace(PTRACE_GETREGS, tid, NULL, &regs);
+        struct ATR_task_sample sample;
+
+        /* seized task runs again after sampling. unwind from the sample */
+        if (ATR_sample_task(&sample, atr, proc, tid) < 0) {
+            ATR_perror(atr);
+            return;
+        }
+
+        uint64_t rip = sample.regs[X8664_CFA_REG_RIP];
 
         fprintf(fp, "<task tid=%d>\n", tid);
 
         fprintf(fp, "==regs==\n");
-        fprintf(fp, "bp=%16llx\n", regs.rbp);
-        fprintf(fp, "sp=%16llx\n", regs.rsp);
+        fprintf(fp, "bp=%16llx\n", (unsigned long long)sample.regs[X8664_CFA_REG_RBP]);
+        fprintf(fp, "sp=%16llx\n", (unsigned long long)sample.regs[X8664_CFA_REG_RSP]);
 
         struct ATR_map_info map;
 
         int r = ATR_lookup_map_info(&map, atr, 
-                                    proc, regs.rip);
+                                    proc, rip);
 
         if (r < 0) {
             char *str = ATR_strerror(atr, &atr->last_error);
-            fprintf(fp, "pc=%16llx unmapped? (%s)\n", regs.rip, str);
+            fprintf(fp, "pc=%16llx unmapped? (%s)\n", (unsigned long long)rip, str);
             ATR_free(atr, str);
             ATR_error_clear(atr, &atr->last_error);
         } else {
             fprintf(fp, "pc=%16llx (path=%s, file_offset=%"PRIxPTR")\n",
-                    regs.rip,
+                    (unsigned long long)rip,
                     map.path->symstr,
                     map.offset);
 
-            struct ATR_file file;
-            int r = ATR_file_open(&file, atr, map.path);
+            struct ATR_file *file = ATR_process_module_file(atr, proc, map.module);
 
-            if (r < 0) {
+            if (file == NULL) {
                 ATR_perror(atr);
+                ATR_task_sample_fini(atr, &sample);
                 return;
             }
 
@@ -298,21 +1287,20 @@ ATR_dump_process(FILE *fp,
                     "  debug_abbrev=%16"PRIxPTR"-%16"PRIxPTR"\n"
                     "  debug_info  =%16"PRIxPTR"-%16"PRIxPTR"\n"
                     "  eh_frame    =%16"PRIxPTR"-%16"PRIxPTR"\n",
-                    file.text.start,
-                    file.text.start + file.text.length,
-                    file.debug_abbrev.start,
-                    file.debug_abbrev.start + file.debug_abbrev.length,
-                    file.debug_info.start,
-                    file.debug_info.start + file.debug_info.length,
-                    file.eh_frame.start,
-                    file.eh_frame.start + file.eh_frame.length);
-
-            ATR_file_close(atr, &file);
+                    file->text.start,
+                    file->text.start + file->text.length,
+                    file->debug_abbrev.start,
+                    file->debug_abbrev.start + file->debug_abbrev.length,
+                    file->debug_info.start,
+                    file->debug_info.start + file->debug_info.length,
+                    file->eh_frame.start,
+                    file->eh_frame.start + file->eh_frame.length);
 
             struct ATR_backtracer tr;
-            r = ATR_backtrace_init(atr, &tr, proc, tid);
+            r = ATR_backtrace_init_sample(atr, &tr, proc, &sample);
             if (r < 0) {
                 ATR_perror(atr);
+                ATR_task_sample_fini(atr, &sample);
                 return;
             }
 
@@ -323,7 +1311,7 @@ ATR_dump_process(FILE *fp,
                 struct ATR_addr_info ai;
 
                 if (tr.state == ATR_BACKTRACER_OK) {
-                    ATR_file_lookup_addr_info(&ai, atr, &tr);
+                    ATR_file_lookup_addr_info(&ai, atr, &tr, depth > 0);
 
                     if (ai.flags & ATR_ADDR_INFO_HAVE_SYMBOL) {
                         fprintf(fp,
@@ -332,13 +1320,13 @@ ATR_dump_process(FILE *fp,
                                 ai.sym->symstr,
                                 (int)ai.sym_offset,
                                 (void*)tr.cfa_regs[X8664_CFA_REG_RIP],
-                                tr.current_module.path->symstr);
+                                tr.current_module->path->symstr);
                     } else {
                         fprintf(fp,
                                 "#%d %p (%s)\n",
                                 depth,
                                 (void*)tr.cfa_regs[X8664_CFA_REG_RIP],
-                                tr.current_module.path->symstr);
+                                tr.current_module->path->symstr);
                     }
 
                     ATR_addr_info_fini(atr, &ai);
@@ -368,5 +1356,7 @@ ATR_dump_process(FILE *fp,
 
             ATR_backtrace_fini(atr, &tr);
         }
+
+        ATR_task_sample_fini(atr, &sample);
     }
 }
@@ -11,9 +11,16 @@ extern "C" {
 struct ATR;
 struct npr_mempool;
 struct npr_symbol;
+struct npr_rbtree;
+
+struct ATR_file;
 
 struct ATR_module {
     struct npr_symbol *path;
+    struct ATR_file *file;      // opened at first use (ATR_process_module_file)
+
+    uint64_t dev, ino;          // from /proc/pid/maps
+    int first_mapping;          // index of lowest mapping in ATR_process::mappings
 };
 
 struct ATR_mapping {
@@ -30,15 +37,23 @@ struct ATR_process {
     struct ATR_module *modules;
 
     int num_mapping;
-    struct ATR_mapping *mappings;
+    struct ATR_mapping *mappings; // sorted by start (malloc-ed)
+    int last_found_mapping;       // index of last result of ATR_find_mapping
 
     int num_task;
     int *tasks;
+    int seized;                 // attached by PTRACE_SEIZE (ATR_ATTACH_SEIZE)
+    struct npr_rbtree *group_stopped; // tids in group-stop (resumed by PTRACE_LISTEN). NULL if none has been
+
+    /* remote memory reader (ATR_read_memory) */
+    int no_vm_readv;            // process_vm_readv is not available
+    int mem_fd;                 // /proc/pid/mem, -1 if not opened
 };
 
 
 /* return negative if failed 
- * (process will be suspended if succeeded)
+ * (process will be suspended if succeeded.
+ *  with ATR_ATTACH_SEIZE, process continues running)
  */
 ATR_EXPORT int ATR_open_process(struct ATR_process *dst,
                                 struct ATR *atr,
@@ -47,6 +62,39 @@ ATR_EXPORT int ATR_open_process(struct ATR_process *dst,
 ATR_EXPORT void ATR_close_process(struct ATR *atr,
                                   struct ATR_process *proc);
 
+/* re-read /proc/pid/maps.
+ * modules that are still mapped from same (dev, ino) with unchanged
+ * mtime keep their opened file and its caches, others are released.
+ * return negative if failed (proc is not changed) */
+ATR_EXPORT int ATR_refresh_process(struct ATR *atr,
+                                   struct ATR_process *proc);
+
+/* stop task to read its registers (PTRACE_INTERRUPT).
+ * nothing to do if process is not seized.
+ * return negative if failed */
+ATR_EXPORT int ATR_stop_task(struct ATR *atr,
+                             struct ATR_process *proc,
+                             int tid);
+
+/* resume task stopped by ATR_stop_task.
+ * task that was in group-stop (SIGSTOP, SIGTSTP, ...) stays stopped */
+ATR_EXPORT void ATR_resume_task(struct ATR *atr,
+                                struct ATR_process *proc,
+                                int tid);
+
+/* restart seized tasks that stopped for signals since last call, without
+ * blocking. signals are delivered, group-stop is kept by PTRACE_LISTEN.
+ * threads created since last call are added to proc->tasks.
+ * (see ATR_ATTACH_SEIZE) */
+ATR_EXPORT void ATR_poll_process(struct ATR *atr,
+                                 struct ATR_process *proc);
+
+/* build modules and mappings of dst from content of /proc/pid/maps.
+ * arrays are allocated by malloc, and freed by ATR_close_process */
+ATR_EXPORT void ATR_parse_maps(struct ATR_process *dst,
+                               const char *buf,
+                               size_t length);
+
 ATR_EXPORT void ATR_dump_process(FILE *fp,
                                  struct ATR *atr,
                                  struct ATR_process *proc);
@@ -54,6 +102,7 @@ ATR_EXPORT void ATR_dump_process(FILE *fp,
 struct ATR_map_info {
     struct npr_symbol *path;
     uintptr_t offset;
+    int module;                 // index of ATR_process::modules
 };
 
 /* return negative if failed */
@@ -62,6 +111,49 @@ ATR_EXPORT int ATR_lookup_map_info(struct ATR_map_info *info,
                                    struct ATR_process *proc,
                                    uintptr_t addr);
 
+/* return NULL if addr is not mapped */
+struct ATR_mapping *ATR_find_mapping(struct ATR_process *proc,
+                                     uintptr_t addr);
+
+struct ATR_mem_read {
+    uintptr_t addr;             // remote address
+    size_t length;
+    void *dst;
+};
+
+/* gather reads of process memory in one process_vm_readv call.
+ * fall back to pread of /proc/pid/mem if process_vm_readv is not available.
+ * return -1 if failed (ATR_READ_FRAME_FAILED) */
+int ATR_read_memory_gather(struct ATR *atr,
+                           struct ATR_process *proc,
+                           struct ATR_mem_read *reads,
+                           int num_read);
+
+/* return -1 if failed */
+int ATR_read_memory(struct ATR *atr,
+                    struct ATR_process *proc,
+                    void *dst,
+                    uintptr_t addr,
+                    size_t length);
+
+/* select unwind method of module that is mapped from path.
+ * ATR_UNWIND_FRAME_POINTER trusts rbp chain of module without CFI
+ * (use it only if module keeps frame pointer in every function).
+ * ATR_UNWIND_DEFAULT follows ATR_backtracer::unwind_method.
+ * method is kept in opened file, so it is shared by processes that map same file.
+ * return negative if path is not mapped, or file couldn't be opened */
+ATR_EXPORT int ATR_set_module_unwind_method(struct ATR *atr,
+                                            struct ATR_process *proc,
+                                            const char *path,
+                                            enum ATR_unwind_method method);
+
+/* return file of module. it is opened at first call, and
+ * closed by ATR_close_process.
+ * return NULL if failed */
+struct ATR_file *ATR_process_module_file(struct ATR *atr,
+                                         struct ATR_process *proc,
+                                         int module);
+
 #ifdef __cplusplus
 }
 #endif
@@ -4,6 +4,7 @@
 #include "anytrace/atr-impl.h"
 #include "anytrace/atr-language-module.h"
 #include "anytrace/atr-backtrace.h"
+#include "anytrace/atr-process.h"
 
 #include "npr/red-black-tree.h"
 #include "npr/varray.h"
@@ -13,12 +14,24 @@ ATR_init(struct ATR *atr)
 {
     npr_symbol_init();
     atr->last_error.code = ATR_NO_ERROR;
+    atr->flags = 0;
+    atr->stack_snapshot_size = 0;
+    atr->unwind_method = ATR_UNWIND_CFI;
+    atr->unwind_memo_size = 1024;
+    atr->unwind_memo_hit = 0;
+    atr->unwind_memo_miss = 0;
+    atr->cache_dir = NULL;
+    atr->debug_dir = "/usr/lib/debug";
     atr->impl = malloc(sizeof(struct ATR_impl));
 
     atr->impl->cap_language = 1;
     atr->num_language = 0;
     atr->languages = malloc(sizeof(struct ATR_language_module) * 1);
     npr_symtab_init(&atr->impl->lang_module_hook_table, 16);
+    ATR_file_cache_init(atr);
+
+    atr->impl->read_buf = NULL;
+    atr->impl->read_buf_size = 0;
 
     ATR_load_language_module(atr);
 }
@@ -42,32 +55,28 @@ void
 ATR_fini(struct ATR *atr)
 {
     ATR_error_clear(atr, &atr->last_error);
+    ATR_file_cache_fini(atr);
+    free(atr->impl->read_buf);
     free(atr->languages);
 }
 
-int
-ATR_get_frame(struct ATR_stack_frame *frame,
-              struct ATR *atr,
-              struct ATR_process *proc,
-              int tid)
+/* unwind from tr, and fill frame */
+static void
+unwind_frame(struct ATR_stack_frame *frame,
+             struct ATR *atr,
+             struct ATR_process *proc,
+             struct ATR_backtracer *tr)
 {
-    frame->frame_up_fail_reason.code = ATR_NO_ERROR;
-
     struct npr_rbtree visited;
-    struct ATR_backtracer tr;
-
     struct npr_varray frames;
 
-    int r = ATR_backtrace_init(atr, &tr, proc, tid);
-    if (r < 0) {
-        return -1;
-    }
+    frame->frame_up_fail_reason.code = ATR_NO_ERROR;
 
     npr_varray_init(&frames, 16, sizeof(struct ATR_stack_frame_entry));
 
     npr_rbtree_init(&visited);
     for (int depth=0; ; depth++) {
-        int insert = npr_rbtree_insert(&visited, tr.cfa_regs[X8664_CFA_REG_RSP], 1);
+        int insert = npr_rbtree_insert(&visited, tr->cfa_regs[X8664_CFA_REG_RSP], 1);
         if (insert == 0) {
             /* loop is detected */
             ATR_set_error_code(atr, &frame->frame_up_fail_reason, ATR_FRAME_HAVE_LOOP);
@@ -79,10 +88,48 @@ ATR_get_frame(struct ATR_stack_frame *frame,
 
         e.flags = ATR_FRAME_HAVE_PC;
         e.num_child_frame = 0;
-        e.pc = tr.cfa_regs[X8664_CFA_REG_RIP];
+        e.pc = tr->cfa_regs[X8664_CFA_REG_RIP];
+
+        if (tr->state == ATR_BACKTRACER_OK) {
+            ATR_file_lookup_addr_info(&ai, atr, tr, depth > 0);
+
+            const char *obj_path = tr->current_module->path->symstr;
+            struct npr_symbol *loc_path = NULL;
+            int loc_line = 0;
+
+            if (ai.flags & ATR_ADDR_INFO_HAVE_LOCATION) {
+                loc_path = ai.source_path;
+                loc_line = ai.lineno;
+            }
+
+            /* inlined calls, innermost first. each one is located at
+             * call site of inner one */
+            for (int ii=ai.num_inline-1; ii>=0; ii--) {
+                const struct ATR_inline_range *inl = ai.inlines[ii];
+                struct ATR_stack_frame_entry ie;
+
+                ie.flags = ATR_FRAME_HAVE_PC | ATR_FRAME_IS_INLINED | ATR_FRAME_HAVE_OBJ_PATH;
+                ie.num_child_frame = 0;
+                ie.pc = e.pc;
+                ie.obj_path = strdup(obj_path);
+
+                if (inl->name) {
+                    ie.flags |= ATR_FRAME_HAVE_SYMBOL;
+                    ie.symbol = inl->name;
+                    ie.symbol_offset = ai.loc_vaddr - inl->begin;
+                }
 
-        if (tr.state == ATR_BACKTRACER_OK) {
-            ATR_file_lookup_addr_info(&ai, atr, &tr);
+                if (loc_path) {
+                    ie.flags |= ATR_FRAME_HAVE_LOCATION;
+                    ie.source_path = strdup(loc_path->symstr);
+                    ie.lineno = loc_line;
+                }
+
+                VA_PUSH(struct ATR_stack_frame_entry, &frames, ie);
+
+                loc_path = inl->call_file;
+                loc_line = inl->call_line;
+            }
 
             if (ai.flags & ATR_ADDR_INFO_HAVE_SYMBOL) {
                 e.flags |= ATR_FRAME_HAVE_SYMBOL;
@@ -90,20 +137,28 @@ ATR_get_frame(struct ATR_stack_frame *frame,
                 e.symbol_offset = ai.sym_offset;
             }
 
+            if (loc_path) {
+                e.flags |= ATR_FRAME_HAVE_LOCATION;
+                e.source_path = strdup(loc_path->symstr);
+                e.lineno = loc_line;
+            }
+
             e.flags |= ATR_FRAME_HAVE_OBJ_PATH;
-            e.obj_path = strdup(tr.current_module.path->symstr);
+            e.obj_path = strdup(obj_path);
+
+            ATR_addr_info_fini(atr, &ai);
         }
 
         VA_PUSH(struct ATR_stack_frame_entry, &frames, e);
 
-        ATR_run_language_hook(atr, &tr, &frames);
+        ATR_run_language_hook(atr, tr, &frames);
 
-        if (tr.state != ATR_BACKTRACER_OK) {
+        if (tr->state != ATR_BACKTRACER_OK) {
             ATR_error_move(atr, &frame->frame_up_fail_reason, &atr->last_error);
             break;
         }
 
-        int r = ATR_backtrace_up(atr, &tr, proc);
+        int r = ATR_backtrace_up(atr, tr, proc);
         if (r != 0) {
             ATR_error_move(atr, &frame->frame_up_fail_reason, &atr->last_error);
             break;
@@ -114,14 +169,110 @@ ATR_get_frame(struct ATR_stack_frame *frame,
     frame->entries = npr_varray_malloc_close(&frames);
 
     npr_rbtree_fini(&visited);
+}
+
+int
+ATR_get_frame(struct ATR_stack_frame *frame,
+              struct ATR *atr,
+              struct ATR_process *proc,
+              int tid)
+{
+    struct ATR_backtracer tr;
+
+    if (ATR_stop_task(atr, proc, tid) < 0) {
+        return -1;
+    }
+
+    int r = ATR_backtrace_init_snapshot(atr, &tr, proc, tid,
+                                        atr->stack_snapshot_size);
+    if (r < 0) {
+        ATR_resume_task(atr, proc, tid);
+        return -1;
+    }
+
+    /* stack is copied. task can run while unwinding */
+    int stopped = 1;
+    if (atr->stack_snapshot_size) {
+        ATR_resume_task(atr, proc, tid);
+        stopped = 0;
+    }
+
+    unwind_frame(frame, atr, proc, &tr);
+
+    ATR_backtrace_fini(atr, &tr);
+
+    if (stopped) {
+        ATR_resume_task(atr, proc, tid);
+    }
 
     return 0;
 }
 
+int
+ATR_sample_task(struct ATR_task_sample *sample,
+                struct ATR *atr,
+                struct ATR_process *proc,
+                int tid)
+{
+    size_t snapshot_size = atr->stack_snapshot_size;
+
+    if (snapshot_size == 0) {
+        snapshot_size = ATR_DEFAULT_SAMPLE_STACK_SIZE;
+    }
+
+    if (ATR_stop_task(atr, proc, tid) < 0) {
+        return -1;
+    }
+
+    int r = ATR_capture_task(atr, sample, proc, tid, snapshot_size);
+
+    ATR_resume_task(atr, proc, tid);
+
+    return r;
+}
+
+int
+ATR_get_frame_from_sample(struct ATR_stack_frame *frame,
+                          struct ATR *atr,
+                          struct ATR_process *proc,
+                          const struct ATR_task_sample *sample)
+{
+    struct ATR_backtracer tr;
+
+    int r = ATR_backtrace_init_sample(atr, &tr, proc, sample);
+    if (r < 0) {
+        return -1;
+    }
+
+    unwind_frame(frame, atr, proc, &tr);
+
+    ATR_backtrace_fini(atr, &tr);
+
+    return 0;
+}
+
+void
+ATR_task_sample_fini(struct ATR *atr,
+                     struct ATR_task_sample *sample)
+{
+    free(sample->stack);
+}
+
 void
 ATR_frame_fini(struct ATR *atr,
                struct ATR_stack_frame *f)
 {
+    for (int ei=0; ei<f->num_entry; ei++) {
+        struct ATR_stack_frame_entry *e = &f->entries[ei];
+
+        if (e->flags & ATR_FRAME_HAVE_OBJ_PATH) {
+            free(e->obj_path);
+        }
+        if (e->flags & ATR_FRAME_HAVE_LOCATION) {
+            free(e->source_path);
+        }
+    }
+
     free(f->entries);
     ATR_error_clear(atr, &f->frame_up_fail_reason);
 }
@@ -1,6 +1,7 @@
 #ifndef ATR_H
 #define ATR_H
 
+#include <stddef.h>
 #include "anytrace/atr-errors.h"
 
 #ifdef __cplusplus
@@ -23,9 +24,68 @@ extern "C" {
 struct ATR_impl;
 struct ATR_process;
 
+enum ATR_unwind_method {
+    ATR_UNWIND_DEFAULT,         // (module) follow ATR_backtracer::unwind_method
+    ATR_UNWIND_CFI,             // .eh_frame
+    /* rbp chain.
+     * ATR::unwind_method : followed only where CFI defines CFA by rbp, CFI elsewhere.
+     * module (ATR_set_module_unwind_method) : trusted without CFI, CFI if chain looks broken */
+    ATR_UNWIND_FRAME_POINTER,
+};
+
+#define ATR_SAMPLE_NUM_REG 18
+
+/* registers and stack of task, captured by ATR_sample_task */
+struct ATR_task_sample {
+    int tid;
+    uint64_t regs[ATR_SAMPLE_NUM_REG]; // dwarf order
+
+    /* copy of [stack_start, stack_start+stack_length) of task.
+     * NULL if it couldn't be read */
+    unsigned char *stack;
+    uintptr_t stack_start;
+    size_t stack_length;
+};
+
+/* ATR_sample_task copies this if ATR::stack_snapshot_size is 0 */
+#define ATR_DEFAULT_SAMPLE_STACK_SIZE (32*1024)
+
 struct ATR {
     struct ATR_Error last_error;
 
+#define ATR_COMPILE_UNWIND_TABLE (1<<0) // compile CFI of module into ATR_file::unwind_table at first use
+#define ATR_ATTACH_SEIZE (1<<1)         // ATR_open_process doesn't stop threads. ATR_get_frame stops thread only while sampling it
+    /* seized threads stay traced between ATR calls. a signal sent to a
+     * thread stops it (signal-delivery-stop) until it is restarted by
+     * next ATR_stop_task/ATR_get_frame of the thread, ATR_poll_process,
+     * or ATR_close_process. same for end of group-stop by SIGCONT.
+     * threads created by seized process are traced too, and stay stopped
+     * at creation until next ATR call.
+     * call ATR_poll_process periodically to bound this latency */
+    int flags;
+
+    /* bytes of stack copied by ATR_get_frame before unwinding.
+     * 0 : read stack on demand */
+    size_t stack_snapshot_size;
+
+    enum ATR_unwind_method unwind_method; // initial value of ATR_backtracer::unwind_method
+
+    /* number of entries of per module memo (pc -> resolved unwind rule).
+     * table is allocated with this size at first use of module.
+     * 0 : disabled */
+    size_t unwind_memo_size;
+    uint64_t unwind_memo_hit, unwind_memo_miss;
+
+    /* directory of persistent module cache (symbol index and compiled
+     * unwind table per build id). created if not exists.
+     * NULL : disabled */
+    const char *cache_dir;
+
+    /* root of separate debug files (<debug_dir>/.build-id/xx/yyyy.debug).
+     * default is /usr/lib/debug.
+     * NULL : separate debug files are not searched */
+    const char *debug_dir;
+
     int num_language;
     struct ATR_language_module *languages;
 
@@ -66,6 +126,7 @@ struct ATR_stack_frame_entry {
 #define ATR_FRAME_HAVE_BOTTOM_LANG (1<<2)
 #define ATR_FRAME_HAVE_PC (1<<3)
 #define ATR_FRAME_HAVE_OBJ_PATH (1<<4)
+#define ATR_FRAME_IS_INLINED (1<<5)   // synthetic entry of inlined call. same pc as next entry
     int flags;
 
     struct npr_symbol *symbol; // valid if HAVE_SYMBOL
@@ -96,6 +157,26 @@ ATR_EXPORT int ATR_get_frame(struct ATR_stack_frame *frame,
 ATR_EXPORT void ATR_frame_fini(struct ATR *atr,
                                struct ATR_stack_frame *frame);
 
+/* stop task, copy its registers and stack, and resume it.
+ * ATR::stack_snapshot_size bytes of stack are copied
+ * (ATR_DEFAULT_SAMPLE_STACK_SIZE if it is 0).
+ * return negative if failed */
+ATR_EXPORT int ATR_sample_task(struct ATR_task_sample *sample,
+                               struct ATR *atr,
+                               struct ATR_process *proc,
+                               int tid);
+
+/* same as ATR_get_frame, but start from sample.
+ * task is not stopped. (saved registers outside of copied stack are
+ * read from running task) */
+ATR_EXPORT int ATR_get_frame_from_sample(struct ATR_stack_frame *frame,
+                                         struct ATR *atr,
+                                         struct ATR_process *proc,
+                                         const struct ATR_task_sample *sample);
+
+ATR_EXPORT void ATR_task_sample_fini(struct ATR *atr,
+                                     struct ATR_task_sample *sample);
+
 ATR_EXPORT void ATR_perror(struct ATR *atr);
 
 
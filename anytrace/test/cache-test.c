@@ -0,0 +1,277 @@
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "anytrace/atr.h"
+#include "anytrace/atr-cache.h"
+#include "anytrace/atr-file.h"
+#include "anytrace/atr-process.h"
+
+/* persistent module cache (.atrc) : write, read back, and reject broken one.
+ *
+ * symbol of frame is read from cache of executable if it is mapped. a name
+ * renamed in cache shows that it is used, and frame built from broken
+ * cache must have original name (cache rejected, and rebuilt from ELF).
+ * unwind table is compiled (ATR_COMPILE_UNWIND_TABLE) after symbol index
+ * is stored, and stored with it */
+
+static int ready_fd = -1;
+static volatile int sink;
+
+__attribute__((noinline)) static void
+cache_test_work(void)
+{
+    char c = 0;
+    ssize_t wr = write(ready_fd, &c, 1);
+    (void)wr;
+    pause();
+    sink++;
+}
+
+static int
+frame_has_symbol(pid_t pid, const char *cache_dir, const char *name, int flags)
+{
+    struct ATR atr;
+    struct ATR_process proc;
+    struct ATR_stack_frame frame;
+    int found = 0;
+
+    ATR_init(&atr);
+    atr.cache_dir = cache_dir;
+    atr.flags |= flags;
+
+    int r = ATR_open_process(&proc, &atr, pid);
+    assert(r == 0);
+    r = ATR_get_frame(&frame, &atr, &proc, pid);
+    assert(r == 0);
+
+    for (int ei=0; ei<frame.num_entry; ei++) {
+        struct ATR_stack_frame_entry *e = &frame.entries[ei];
+
+        if ((e->flags & ATR_FRAME_HAVE_SYMBOL) &&
+            strcmp(ATR_get_symstr(e->symbol), name) == 0)
+        {
+            found = 1;
+        }
+    }
+
+    ATR_frame_fini(&atr, &frame);
+    ATR_close_process(&atr, &proc);
+    ATR_fini(&atr);
+
+    return found;
+}
+
+static unsigned char *
+read_file(const char *path, size_t *length)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    assert(fd >= 0);
+    int r = fstat(fd, &st);
+    assert(r == 0);
+
+    unsigned char *buf = malloc(st.st_size);
+    ssize_t rd = read(fd, buf, st.st_size);
+    assert(rd == st.st_size);
+    close(fd);
+
+    *length = st.st_size;
+    return buf;
+}
+
+/* replace cache by rename, as ATR_file_store_cache does */
+static void
+write_file(const char *path, const unsigned char *buf, size_t length)
+{
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.test.tmp", path);
+
+    int fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    assert(fd >= 0);
+    ssize_t wr = write(fd, buf, length);
+    assert(wr == (ssize_t)length);
+    close(fd);
+
+    int r = rename(tmp, path);
+    assert(r == 0);
+}
+
+/* return offset of name in names of cache, or 0 if not found */
+static uint64_t
+find_name(const unsigned char *buf, size_t length, const char *name)
+{
+    const struct ATR_cache_header *h = (const struct ATR_cache_header*)buf;
+    size_t name_len = strlen(name) + 1;
+
+    if (length < sizeof(*h) || h->names_offset + h->names_length > length) {
+        return 0;
+    }
+
+    for (uint64_t off=0; off + name_len <= h->names_length; off++) {
+        const unsigned char *p = buf + h->names_offset + off;
+
+        if ((off == 0 || p[-1] == '\0') && memcmp(p, name, name_len) == 0) {
+            return h->names_offset + off;
+        }
+    }
+
+    return 0;
+}
+
+int
+main()
+{
+    char tmp_dir[] = "/tmp/atr-cache-test-XXXXXX";
+    char *d = mkdtemp(tmp_dir);
+    assert(d);
+
+    /* created by first store */
+    char cache_dir[sizeof(tmp_dir) + 16];
+    snprintf(cache_dir, sizeof(cache_dir), "%s/cache", tmp_dir);
+
+    int fds[2];
+    int r = pipe(fds);
+    assert(r == 0);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* don't outlive failed assert of parent */
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        close(fds[0]);
+        ready_fd = fds[1];
+        cache_test_work();
+        exit(0);
+    }
+
+    close(fds[1]);
+    char c;
+    ssize_t rd = read(fds[0], &c, 1);
+    assert(rd == 1);
+
+    /* write. symbol index first, unwind table is added by next run */
+    assert(frame_has_symbol(pid, cache_dir, "cache_test_work", 0));
+    assert(frame_has_symbol(pid, cache_dir, "cache_test_work", ATR_COMPILE_UNWIND_TABLE));
+
+    /* find cache of executable */
+    char path[PATH_MAX];
+    unsigned char *orig = NULL;
+    size_t length = 0;
+    uint64_t name_off = 0;
+
+    DIR *dir = opendir(cache_dir);
+    assert(dir);
+    struct dirent *de;
+    while (name_off == 0 && (de = readdir(dir)) != NULL) {
+        size_t nl = strlen(de->d_name);
+        if (nl < 5 || strcmp(de->d_name + nl - 5, ".atrc") != 0) {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "%s/%s", cache_dir, de->d_name);
+        free(orig);
+        orig = read_file(path, &length);
+        name_off = find_name(orig, length, "cache_test_work");
+    }
+    closedir(dir);
+    assert(name_off != 0);
+
+    struct ATR_cache_header *oh = (struct ATR_cache_header*)orig;
+    assert(oh->sym_index_entry_size == sizeof(struct ATR_sym_index_entry));
+    assert(oh->unwind_row_size == sizeof(struct ATR_unwind_row));
+    assert(oh->flags & ATR_CACHE_HAVE_SYM_INDEX);
+    assert(oh->flags & ATR_CACHE_HAVE_UNWIND_TABLE);
+    assert(oh->num_sym_index > 0 && oh->num_unwind_row > 0);
+
+    unsigned char *buf = malloc(length);
+    struct ATR_cache_header *h = (struct ATR_cache_header*)buf;
+    struct ATR_sym_index_entry *sym_index = (struct ATR_sym_index_entry*)(buf + oh->sym_index_offset);
+    struct ATR_unwind_row *rows = (struct ATR_unwind_row*)(buf + oh->unwind_table_offset);
+
+    /* read back */
+    memcpy(buf, orig, length);
+    buf[name_off + 11] = 'W';
+    write_file(path, buf, length);
+    assert(frame_has_symbol(pid, cache_dir, "cache_test_Work", ATR_COMPILE_UNWIND_TABLE));
+
+    /* name out of names */
+    memcpy(buf, orig, length);
+    buf[name_off + 11] = 'W';
+    for (uint64_t si=0; si<h->num_sym_index; si++) {
+        if (sym_index[si].name == name_off - h->names_offset) {
+            sym_index[si].name = h->names_length + 4096;
+        }
+    }
+    write_file(path, buf, length);
+    assert(frame_has_symbol(pid, cache_dir, "cache_test_work", ATR_COMPILE_UNWIND_TABLE));
+
+    /* offset + count * size wraps to 8 */
+    memcpy(buf, orig, length);
+    buf[name_off + 11] = 'W';
+    h->num_sym_index = UINT64_MAX / sizeof(struct ATR_sym_index_entry) + 1;
+    assert(h->sym_index_offset + h->num_sym_index * sizeof(struct ATR_sym_index_entry) <= length);
+    write_file(path, buf, length);
+    assert(frame_has_symbol(pid, cache_dir, "cache_test_work", ATR_COMPILE_UNWIND_TABLE));
+
+    /* misaligned array */
+    memcpy(buf, orig, length);
+    buf[name_off + 11] = 'W';
+    h->unwind_table_offset += 4;
+    h->num_unwind_row--;
+    write_file(path, buf, length);
+    assert(frame_has_symbol(pid, cache_dir, "cache_test_work", ATR_COMPILE_UNWIND_TABLE));
+
+    /* broken unwind row */
+    memcpy(buf, orig, length);
+    buf[name_off + 11] = 'W';
+    rows[0].type = ATR_UNWIND_ROW_END + 1;
+    write_file(path, buf, length);
+    assert(frame_has_symbol(pid, cache_dir, "cache_test_work", ATR_COMPILE_UNWIND_TABLE));
+
+    memcpy(buf, orig, length);
+    buf[name_off + 11] = 'W';
+    rows[0].type = ATR_UNWIND_ROW_CFA;
+    rows[0].cfa_reg = 255;
+    write_file(path, buf, length);
+    assert(frame_has_symbol(pid, cache_dir, "cache_test_work", ATR_COMPILE_UNWIND_TABLE));
+
+    /* truncated */
+    memcpy(buf, orig, length);
+    buf[name_off + 11] = 'W';
+    write_file(path, buf, oh->names_offset);
+    assert(frame_has_symbol(pid, cache_dir, "cache_test_work", ATR_COMPILE_UNWIND_TABLE));
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+
+    /* rejected cache is rebuilt */
+    free(orig);
+    orig = read_file(path, &length);
+    assert(find_name(orig, length, "cache_test_work") != 0);
+
+    free(orig);
+    free(buf);
+
+    dir = opendir(cache_dir);
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", cache_dir, de->d_name);
+            unlink(path);
+        }
+    }
+    closedir(dir);
+    rmdir(cache_dir);
+    rmdir(tmp_dir);
+
+    return 0;
+}
@@ -0,0 +1,21 @@
+#include <unistd.h>
+
+/* target of debuglink-test. its debug info is moved to a separate file
+ * (see CMakeLists.txt). writes a byte to stdout, and waits for stdin */
+
+__attribute__((noinline)) static void
+debuglink_target_wait(void)
+{
+    char c = 0;
+    ssize_t wr = write(1, &c, 1);
+    ssize_t rd = read(0, &c, 1);
+    (void)wr;
+    (void)rd;
+}
+
+int
+main()
+{
+    debuglink_target_wait();
+    return 0;
+}
@@ -0,0 +1,154 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "anytrace/atr.h"
+#include "anytrace/atr-process.h"
+
+/* separate debug file found by .gnu_debuglink is used only if its crc
+ * matches.
+ *
+ * usage : debuglink-test <stripped target> <debug file of target>
+ * both are copied to temporary directory, with name of debug file kept
+ * (it is recorded in .gnu_debuglink of target) */
+
+static void
+copy_file(const char *dst, const char *src, int mode)
+{
+    int in = open(src, O_RDONLY);
+    assert(in >= 0);
+    int out = open(dst, O_WRONLY|O_CREAT|O_TRUNC, mode);
+    assert(out >= 0);
+
+    char buf[65536];
+    ssize_t rd;
+    while ((rd = read(in, buf, sizeof(buf))) > 0) {
+        ssize_t wr = write(out, buf, rd);
+        assert(wr == rd);
+    }
+    assert(rd == 0);
+
+    close(in);
+    close(out);
+}
+
+/* return 1 if frame has debuglink_target_wait with source location,
+ * 0 if it has the symbol without location */
+static int
+frame_has_location(pid_t pid, const char *debug_dir)
+{
+    struct ATR atr;
+    struct ATR_process proc;
+    struct ATR_stack_frame frame;
+    int found = -1;
+
+    ATR_init(&atr);
+    atr.debug_dir = debug_dir;
+
+    int r = ATR_open_process(&proc, &atr, pid);
+    assert(r == 0);
+    r = ATR_get_frame(&frame, &atr, &proc, pid);
+    assert(r == 0);
+
+    for (int ei=0; ei<frame.num_entry; ei++) {
+        struct ATR_stack_frame_entry *e = &frame.entries[ei];
+
+        if ((e->flags & ATR_FRAME_HAVE_SYMBOL) &&
+            strcmp(ATR_get_symstr(e->symbol), "debuglink_target_wait") == 0)
+        {
+            found = 0;
+
+            if (e->flags & ATR_FRAME_HAVE_LOCATION) {
+                const char *base = strrchr(e->source_path, '/');
+                base = base ? base+1 : e->source_path;
+                assert(strcmp(base, "debuglink-target.c") == 0);
+                found = 1;
+            }
+        }
+    }
+    assert(found >= 0);
+
+    ATR_frame_fini(&atr, &frame);
+    ATR_close_process(&atr, &proc);
+    ATR_fini(&atr);
+
+    return found;
+}
+
+int
+main(int argc, char **argv)
+{
+    assert(argc > 2);
+
+    char dir[] = "/tmp/atr-debuglink-test-XXXXXX";
+    char *d = mkdtemp(dir);
+    assert(d);
+
+    /* empty. keeps build id lookup away from installed debug files */
+    char debug_dir[PATH_MAX];
+    snprintf(debug_dir, sizeof(debug_dir), "%s/debug", dir);
+
+    char target[PATH_MAX], debug_file[PATH_MAX];
+    const char *debug_name = strrchr(argv[2], '/');
+    debug_name = debug_name ? debug_name+1 : argv[2];
+    snprintf(target, sizeof(target), "%s/target", dir);
+    snprintf(debug_file, sizeof(debug_file), "%s/%s", dir, debug_name);
+
+    copy_file(target, argv[1], 0755);
+    copy_file(debug_file, argv[2], 0644);
+
+    int in[2], out[2];
+    int r = pipe(in);
+    assert(r == 0);
+    r = pipe(out);
+    assert(r == 0);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* don't outlive failed assert of parent */
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        dup2(in[0], 0);
+        dup2(out[1], 1);
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        execl(target, target, (char*)NULL);
+        _exit(1);
+    }
+
+    close(in[0]);
+    close(out[1]);
+
+    char c;
+    ssize_t rd = read(out[0], &c, 1);
+    assert(rd == 1);
+
+    assert(frame_has_location(pid, debug_dir) == 1);
+
+    /* same build id, but crc doesn't match */
+    int fd = open(debug_file, O_WRONLY|O_APPEND);
+    assert(fd >= 0);
+    ssize_t wr = write(fd, "x", 1);
+    assert(wr == 1);
+    close(fd);
+
+    assert(frame_has_location(pid, debug_dir) == 0);
+
+    close(in[1]);
+    waitpid(pid, NULL, 0);
+
+    unlink(target);
+    unlink(debug_file);
+    rmdir(dir);
+
+    return 0;
+}
@@ -0,0 +1,168 @@
+#include <assert.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include "anytrace/atr.h"
+#include "anytrace/atr-process.h"
+
+/* source locations (.debug_line) and inlined calls (.debug_info) of frames.
+ *
+ * forked child blocks in frame_test_block, and sends lines of calls
+ * on its stack through pipe. this file is built with -g -O2
+ * (see CMakeLists.txt) */
+
+#define NUM_CALL 3
+
+static int ready_fd = -1;
+static int call_lines[NUM_CALL]; // innermost first
+static volatile int sink;
+
+__attribute__((noinline)) static void
+frame_test_block(void)
+{
+    ssize_t wr = write(ready_fd, call_lines, sizeof(call_lines));
+    (void)wr;
+    pause();
+    sink++;
+}
+
+static inline __attribute__((always_inline)) void
+frame_test_inline(void)
+{
+    call_lines[0] = __LINE__; frame_test_block();
+    sink++;
+}
+
+__attribute__((noinline)) static void
+frame_test_work(void)
+{
+    call_lines[1] = __LINE__; frame_test_inline();
+    sink++;
+}
+
+__attribute__((noinline)) static void
+frame_test_run(void)
+{
+    call_lines[2] = __LINE__; frame_test_work();
+    sink++;
+}
+
+static struct ATR_stack_frame_entry *
+find_entry(struct ATR_stack_frame *frame, const char *sym)
+{
+    for (int ei=0; ei<frame->num_entry; ei++) {
+        struct ATR_stack_frame_entry *e = &frame->entries[ei];
+
+        if ((e->flags & ATR_FRAME_HAVE_SYMBOL) &&
+            strcmp(ATR_get_symstr(e->symbol), sym) == 0)
+        {
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+check_location(struct ATR_stack_frame_entry *e, int lineno)
+{
+    assert(e);
+    assert(e->flags & ATR_FRAME_HAVE_LOCATION);
+    assert(e->lineno == lineno);
+
+    const char *base = strrchr(e->source_path, '/');
+    base = base ? base+1 : e->source_path;
+    assert(strcmp(base, "frame-test.c") == 0);
+}
+
+int
+main()
+{
+    int fds[2];
+    int r = pipe(fds);
+    assert(r == 0);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* don't outlive failed assert of parent */
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        close(fds[0]);
+        ready_fd = fds[1];
+        frame_test_run();
+        exit(0);
+    }
+
+    close(fds[1]);
+
+    int lines[NUM_CALL];
+    ssize_t rd = read(fds[0], lines, sizeof(lines));
+    assert(rd == sizeof(lines));
+
+    struct ATR atr;
+    struct ATR_process proc;
+
+    ATR_init(&atr);
+    r = ATR_open_process(&proc, &atr, pid);
+    assert(r == 0);
+
+    struct ATR_stack_frame frame;
+    r = ATR_get_frame(&frame, &atr, &proc, pid);
+    assert(r == 0);
+
+    /* inlined call is entry of its own, followed by entry of caller with same pc */
+    struct ATR_stack_frame_entry *inl = find_entry(&frame, "frame_test_inline");
+    struct ATR_stack_frame_entry *work = find_entry(&frame, "frame_test_work");
+
+    assert(inl && work);
+    assert(inl->flags & ATR_FRAME_IS_INLINED);
+    assert(! (work->flags & ATR_FRAME_IS_INLINED));
+    assert(inl + 1 == work);
+    assert(inl->pc == work->pc);
+
+    check_location(inl, lines[0]);
+    check_location(work, lines[1]);
+    check_location(find_entry(&frame, "frame_test_run"), lines[2]);
+
+    /* second unwind of same stack resolves rules from memo */
+    struct ATR_stack_frame frame2;
+    uint64_t hit = atr.unwind_memo_hit;
+    r = ATR_get_frame(&frame2, &atr, &proc, pid);
+    assert(r == 0);
+    assert(atr.unwind_memo_hit > hit);
+
+    assert(frame2.num_entry == frame.num_entry);
+    for (int ei=0; ei<frame.num_entry; ei++) {
+        struct ATR_stack_frame_entry *e = &frame.entries[ei], *e2 = &frame2.entries[ei];
+
+        assert(e2->flags == e->flags);
+        assert(! (e->flags & ATR_FRAME_HAVE_PC) || e2->pc == e->pc);
+        assert(! (e->flags & ATR_FRAME_HAVE_SYMBOL) || e2->symbol == e->symbol);
+        assert(! ((e->flags & ATR_FRAME_HAVE_PC) && (e->flags & ATR_FRAME_HAVE_SYMBOL)) ||
+               e2->symbol_offset == e->symbol_offset);
+
+        if (e->flags & ATR_FRAME_HAVE_LOCATION) {
+            assert(e2->lineno == e->lineno);
+            assert(strcmp(e2->source_path, e->source_path) == 0);
+        }
+
+        if (e->flags & ATR_FRAME_HAVE_OBJ_PATH) {
+            assert(strcmp(e2->obj_path, e->obj_path) == 0);
+        }
+    }
+
+    ATR_frame_fini(&atr, &frame2);
+    ATR_frame_fini(&atr, &frame);
+    ATR_close_process(&atr, &proc);
+    ATR_fini(&atr);
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+
+    return 0;
+}
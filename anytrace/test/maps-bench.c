@@ -0,0 +1,87 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "anytrace/atr.h"
+#include "anytrace/atr-process.h"
+#include "npr/strbuf.h"
+
+/* ATR_parse_maps against synthetic /proc/pid/maps */
+
+static double
+sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+int
+main(int argc, char **argv)
+{
+    int num_module = 2000;
+    int map_per_module = 5;
+    int num_iter = 50;
+
+    if (argc > 1) {
+        num_module = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        num_iter = atoi(argv[2]);
+    }
+
+    struct ATR atr;
+    ATR_init(&atr);
+
+    struct npr_strbuf sb;
+    npr_strbuf_init(&sb);
+
+    unsigned long long addr = 0x7f0000000000ULL;
+    int num_mapping = 0;
+
+    for (int mi=0; mi<num_module; mi++) {
+        for (int pi=0; pi<map_per_module; pi++) {
+            npr_strbuf_printf(&sb, "%llx-%llx r-xp %08x fd:01 %d"
+                              "                      /usr/lib/x86_64-linux-gnu/libbench-%d.so.%d\n",
+                              addr, addr+0x1000, pi*0x1000, 1000000+mi, mi, mi%7);
+            addr += 0x1000;
+            num_mapping++;
+        }
+
+        /* anonymous (bss) */
+        npr_strbuf_printf(&sb, "%llx-%llx rw-p 00000000 00:00 0 \n", addr, addr+0x1000);
+        addr += 0x2000;
+    }
+
+    size_t length = sb.cur;
+    char *buf = npr_strbuf_c_str(&sb);
+
+    double t0 = sec();
+
+    for (int ii=0; ii<num_iter; ii++) {
+        struct ATR_process proc;
+
+        ATR_parse_maps(&proc, buf, length);
+
+        assert(proc.num_mapping == num_mapping);
+        assert(proc.num_module == num_module);
+
+        free(proc.mappings);
+        free(proc.modules);
+    }
+
+    double t1 = sec();
+    double total = (t1-t0);
+
+    printf("%d mappings, %d bytes : %f[usec/parse] %f[nsec/line] %f[MB/s]\n",
+           num_mapping, (int)length,
+           total/num_iter * 1e6,
+           total/num_iter/num_mapping * 1e9,
+           length*(double)num_iter/total/(1024*1024));
+
+    npr_strbuf_fini(&sb);
+    ATR_fini(&atr);
+
+    return 0;
+}
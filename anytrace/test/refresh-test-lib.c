@@ -0,0 +1,9 @@
+/* loaded by refresh-test after process is opened */
+
+int refresh_test_lib_func(void);
+
+int
+refresh_test_lib_func(void)
+{
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include <assert.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "anytrace/atr.h"
+#include "anytrace/atr-process.h"
+
+/* ATR_refresh_process keeps opened file of module that is still mapped,
+ * unless the file was modified.
+ *
+ * forked child is opened with ATR_ATTACH_SEIZE, and loads library
+ * (argv[1]) by dlopen while it is opened */
+
+static void
+run_child(int cmd_fd, int ack_fd, const char *lib)
+{
+    char c;
+
+    while (read(cmd_fd, &c, 1) == 1) {
+        if (c == 'd') {
+            void *h = dlopen(lib, RTLD_NOW);
+            assert(h);
+        }
+
+        ssize_t wr = write(ack_fd, &c, 1);
+        (void)wr;
+    }
+
+    exit(0);
+}
+
+static int
+find_module(struct ATR_process *proc, const char *path)
+{
+    struct npr_symbol *sym = ATR_intern(path);
+
+    for (int mi=0; mi<proc->num_module; mi++) {
+        if (proc->modules[mi].path == sym) {
+            return mi;
+        }
+    }
+
+    return -1;
+}
+
+static void
+command(int cmd_fd, int ack_fd, char c)
+{
+    ssize_t wr = write(cmd_fd, &c, 1);
+    assert(wr == 1);
+
+    char ack;
+    ssize_t rd = read(ack_fd, &ack, 1);
+    assert(rd == 1 && ack == c);
+}
+
+int
+main(int argc, char **argv)
+{
+    assert(argc > 1);
+
+    char exe_path[PATH_MAX], lib_path[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", exe_path, sizeof(exe_path)-1);
+    assert(len > 0);
+    exe_path[len] = '\0';
+    char *rp = realpath(argv[1], lib_path);
+    assert(rp);
+
+    int cmd[2], ack[2];
+    int r = pipe(cmd);
+    assert(r == 0);
+    r = pipe(ack);
+    assert(r == 0);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* don't outlive failed assert of parent */
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        close(cmd[1]);
+        close(ack[0]);
+        run_child(cmd[0], ack[1], argv[1]);
+    }
+
+    close(cmd[0]);
+    close(ack[1]);
+    command(cmd[1], ack[0], 's');
+
+    struct ATR atr;
+    struct ATR_process proc;
+
+    ATR_init(&atr);
+    atr.flags |= ATR_ATTACH_SEIZE;
+    r = ATR_open_process(&proc, &atr, pid);
+    assert(r == 0);
+
+    /* open file of executable */
+    struct ATR_stack_frame frame;
+    r = ATR_get_frame(&frame, &atr, &proc, pid);
+    assert(r == 0);
+    ATR_frame_fini(&atr, &frame);
+
+    int exe = find_module(&proc, exe_path);
+    assert(exe >= 0);
+    struct ATR_file *exe_file = proc.modules[exe].file;
+    assert(exe_file);
+    assert(find_module(&proc, lib_path) < 0);
+
+    command(cmd[1], ack[0], 'd');
+
+    r = ATR_refresh_process(&atr, &proc);
+    assert(r == 0);
+
+    exe = find_module(&proc, exe_path);
+    assert(exe >= 0);
+    assert(proc.modules[exe].file == exe_file);
+    assert(find_module(&proc, lib_path) >= 0);
+
+    r = ATR_get_frame(&frame, &atr, &proc, pid);
+    assert(r == 0);
+    ATR_frame_fini(&atr, &frame);
+
+    /* same (dev, ino), newer mtime */
+    r = ATR_set_module_unwind_method(&atr, &proc, lib_path, ATR_UNWIND_DEFAULT);
+    assert(r == 0);
+    struct ATR_file *lib_file = proc.modules[find_module(&proc, lib_path)].file;
+    assert(lib_file);
+
+    r = utimensat(AT_FDCWD, lib_path, NULL, 0);
+    assert(r == 0);
+    r = ATR_refresh_process(&atr, &proc);
+    assert(r == 0);
+
+    int lib = find_module(&proc, lib_path);
+    assert(lib >= 0);
+    assert(proc.modules[lib].file == NULL);
+    assert(proc.modules[find_module(&proc, exe_path)].file == exe_file);
+
+    ATR_close_process(&atr, &proc);
+    ATR_fini(&atr);
+
+    close(cmd[1]);
+    waitpid(pid, NULL, 0);
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include <assert.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "anytrace/atr.h"
+#include "anytrace/atr-process.h"
+
+/* thread created by seized process is traced, and runs after
+ * ATR_poll_process.
+ *
+ * forked child creates thread when it is told to. the thread sends its
+ * tid */
+
+static int ack_fd = -1;
+
+static void *
+thread_main(void *arg)
+{
+    int tid = (int)syscall(SYS_gettid);
+    ssize_t wr = write(ack_fd, &tid, sizeof(tid));
+    (void)wr;
+
+    while (1) {
+        pause();
+    }
+
+    return arg;
+}
+
+static void
+run_child(int cmd_fd)
+{
+    char c;
+
+    while (read(cmd_fd, &c, 1) == 1) {
+        pthread_t th;
+        pthread_create(&th, NULL, thread_main, NULL);
+    }
+
+    exit(0);
+}
+
+static int
+has_task(struct ATR_process *proc, int tid)
+{
+    for (int ti=0; ti<proc->num_task; ti++) {
+        if (proc->tasks[ti] == tid) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* return 1 if ack arrived within timeout_ms */
+static int
+wait_ack(int fd, int timeout_ms)
+{
+    struct pollfd p;
+    p.fd = fd;
+    p.events = POLLIN;
+
+    return poll(&p, 1, timeout_ms) == 1;
+}
+
+int
+main()
+{
+    int cmd[2], ack[2];
+    int r = pipe(cmd);
+    assert(r == 0);
+    r = pipe(ack);
+    assert(r == 0);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* don't outlive failed assert of parent */
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        close(cmd[1]);
+        close(ack[0]);
+        ack_fd = ack[1];
+        run_child(cmd[0]);
+    }
+
+    close(cmd[0]);
+    close(ack[1]);
+
+    struct ATR atr;
+    struct ATR_process proc;
+
+    ATR_init(&atr);
+    atr.flags |= ATR_ATTACH_SEIZE;
+    r = ATR_open_process(&proc, &atr, pid);
+    assert(r == 0);
+    assert(proc.num_task == 1);
+
+    ssize_t wr = write(cmd[1], "t", 1);
+    assert(wr == 1);
+
+    /* creator and new thread stay stopped at clone */
+    assert(! wait_ack(ack[0], 200));
+
+    int polled = 0;
+    while (! wait_ack(ack[0], 10)) {
+        ATR_poll_process(&atr, &proc);
+        assert(++polled < 1000);
+    }
+
+    int tid;
+    ssize_t rd = read(ack[0], &tid, sizeof(tid));
+    assert(rd == sizeof(tid));
+    assert(proc.num_task == 2);
+    assert(has_task(&proc, tid));
+
+    /* new thread can be sampled, and is detached at close */
+    struct ATR_stack_frame frame;
+    r = ATR_get_frame(&frame, &atr, &proc, tid);
+    assert(r == 0);
+    ATR_frame_fini(&atr, &frame);
+
+    ATR_close_process(&atr, &proc);
+    ATR_fini(&atr);
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include "anytrace/atr.h"
+#include "anytrace/atr-process.h"
+
+/* copies of same binary at different paths share one ATR_file (build id).
+ *
+ * this program is run as target with argument "child", from its own path
+ * and from a copy in temporary directory */
+
+struct child {
+    pid_t pid;
+    int in_fd;                  // closed to finish child
+};
+
+static void
+copy_file(const char *dst, const char *src, int mode)
+{
+    int in = open(src, O_RDONLY);
+    assert(in >= 0);
+    int out = open(dst, O_WRONLY|O_CREAT|O_TRUNC, mode);
+    assert(out >= 0);
+
+    char buf[65536];
+    ssize_t rd;
+    while ((rd = read(in, buf, sizeof(buf))) > 0) {
+        ssize_t wr = write(out, buf, rd);
+        assert(wr == rd);
+    }
+    assert(rd == 0);
+
+    close(in);
+    close(out);
+}
+
+static void
+spawn(struct child *c, const char *path)
+{
+    int in[2], out[2];
+    int r = pipe(in);
+    assert(r == 0);
+    r = pipe(out);
+    assert(r == 0);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* don't outlive failed assert of parent */
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        dup2(in[0], 0);
+        dup2(out[1], 1);
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        execl(path, path, "child", (char*)NULL);
+        _exit(1);
+    }
+
+    close(in[0]);
+    close(out[1]);
+
+    char ch;
+    ssize_t rd = read(out[0], &ch, 1);
+    assert(rd == 1);
+    close(out[0]);
+
+    c->pid = pid;
+    c->in_fd = in[1];
+}
+
+static struct ATR_file *
+module_file(struct ATR *atr, struct ATR_process *proc, const char *path)
+{
+    struct ATR_stack_frame frame;
+    int r = ATR_get_frame(&frame, atr, proc, proc->pid);
+    assert(r == 0);
+    ATR_frame_fini(atr, &frame);
+
+    struct npr_symbol *sym = ATR_intern(path);
+    for (int mi=0; mi<proc->num_module; mi++) {
+        if (proc->modules[mi].path == sym) {
+            return proc->modules[mi].file;
+        }
+    }
+
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "child") == 0) {
+        char c = 0;
+        ssize_t wr = write(1, &c, 1);
+        ssize_t rd = read(0, &c, 1);
+        (void)wr;
+        (void)rd;
+        return 0;
+    }
+
+    char exe[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe)-1);
+    assert(len > 0);
+    exe[len] = '\0';
+
+    char dir[] = "/tmp/atr-share-test-XXXXXX";
+    char *d = mkdtemp(dir);
+    assert(d);
+    char copy[PATH_MAX];
+    snprintf(copy, sizeof(copy), "%s/share-test", dir);
+    copy_file(copy, exe, 0755);
+
+    struct child c0, c1;
+    spawn(&c0, exe);
+    spawn(&c1, copy);
+
+    struct ATR atr;
+    struct ATR_process p0, p1;
+
+    ATR_init(&atr);
+    int r = ATR_open_process(&p0, &atr, c0.pid);
+    assert(r == 0);
+    r = ATR_open_process(&p1, &atr, c1.pid);
+    assert(r == 0);
+
+    struct ATR_file *f0 = module_file(&atr, &p0, exe);
+    struct ATR_file *f1 = module_file(&atr, &p1, copy);
+    assert(f0);
+    assert(f0 == f1);
+
+    ATR_close_process(&atr, &p0);
+    ATR_close_process(&atr, &p1);
+    ATR_fini(&atr);
+
+    close(c0.in_fd);
+    close(c1.in_fd);
+    waitpid(c0.pid, NULL, 0);
+    waitpid(c1.pid, NULL, 0);
+
+    unlink(copy);
+    rmdir(dir);
+
+    return 0;
+}
@@ -202,6 +202,26 @@ npr_rbtree_has_key(struct npr_rbtree *t, npr_rbtree_key_t key)
     return has_key(t->root, key);
 }
 
+struct npr_rbtree_node *
+npr_rbtree_find(struct npr_rbtree *t, npr_rbtree_key_t key)
+{
+    struct npr_rbtree_node *n = t->root;
+
+    while (n) {
+        if (key == n->key) {
+            return n;
+        }
+
+        if (key < n->key) {
+            n = n->left;
+        } else {
+            n = n->right;
+        }
+    }
+
+    return NULL;
+}
+
 
 static void
 dump_node(struct npr_rbtree_node *n, int depth)
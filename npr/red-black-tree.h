@@ -32,6 +32,9 @@ void npr_rbtree_delete(struct npr_rbtree *t, npr_rbtree_key_t key);
 
 int npr_rbtree_has_key(struct npr_rbtree *t, npr_rbtree_key_t key);
 
+/* return NULL if tree doesn't have key */
+struct npr_rbtree_node *npr_rbtree_find(struct npr_rbtree *t, npr_rbtree_key_t key);
+
 typedef void (*npr_rbtree_traverse_func_t)(struct npr_rbtree_node *n, void *arg);
 
 void npr_rbtree_traverse(struct npr_rbtree *t, npr_rbtree_traverse_func_t f, void *arg); 
@@ -49,7 +49,11 @@ npr_intern_with_hash( const char * symstr, size_t str_len, unsigned int hval )
     while ( chain ) {
         if ((chain->value->symstr_len == str_len) &&
             (memcmp(chain->value->symstr,symstr,str_len) == 0))
-            return chain->value;
+        {
+            sym = chain->value;
+            pthread_mutex_unlock(&sym_lock);
+            return sym;
+        }
 
         chain = chain->chain;
     }
@@ -21,6 +21,9 @@ main()
     assert(npr_rbtree_has_key(&t, 400));
     assert(npr_rbtree_has_key(&t, 500));
 
+    assert(npr_rbtree_find(&t, 300)->v == 3000);
+    assert(npr_rbtree_find(&t, 301) == NULL);
+
     //npr_rbtree_dump(&t);
 
     npr_rbtree_fini(&t);